@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -25,71 +25,254 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "mmu.h"
+#include "slab.h"
+#include "memstat.h"
 
-struct {
-  struct spinlock lock;
-  struct buf buf[NBUF];
+#define NBUCKET   13  // hash buckets, prime
+#define BCRESERVE 8   // grow while over 1/BCRESERVE of memory is free
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
+// Buffers are hashed by (dev, blockno) into buckets, each with
+// its own lock and its own list, most recently used first, so
+// lookups of different blocks do not contend. A miss takes the
+// least recently used free buffer of some bucket, holding one
+// bucket lock at a time, then rechecks its own bucket.
+//
+// The cache starts with NBUF buffers. Headers come from a slab
+// cache and data from kmalloc() (kalloc() for blocks too big for
+// it). A miss allocates a new buffer while memory is plentiful;
+// once it is low, misses recycle buffers and bshrink() frees
+// unused ones down to NBUF.
+struct bucket {
+  struct spinlock lock;
   struct buf head;
+  uint hits;
+  uint misses;
+  uint evicts;
+};
+
+struct {
+  struct spinlock lock;       // protects nbuf
+  int nbuf;
+  struct kmem_cache *cache;   // buf headers
+  struct bucket bucket[NBUCKET];
+  uint hand;  // bucket to steal from next; updated without a lock
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+static void
+bfront(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Allocate a buffer, in no bucket. Returns 0 if out of memory.
+static struct buf*
+bnew(void)
+{
+  struct buf *b;
+
+  if((b = kmem_cache_alloc(bcache.cache)) == 0)
+    return 0;
+#if BSIZE <= KMALLOC_MAX
+  b->data = kmalloc(BSIZE);
+#else
+  b->data = (uchar*)kalloc();
+#endif
+  if(b->data == 0){
+    kmem_cache_free(bcache.cache, b);
+    return 0;
+  }
+  initsleeplock(&b->lock, "buffer");
+  b->flags = 0;
+  b->dev = -1;
+  b->blockno = 0;
+  b->refcnt = 0;
+  b->qnext = 0;
+  acquire(&bcache.lock);
+  bcache.nbuf++;
+  release(&bcache.lock);
+  return b;
+}
+
+static void
+bdestroy(struct buf *b)
+{
+#if BSIZE <= KMALLOC_MAX
+  kmfree(b->data);
+#else
+  kfree((char*)b->data);
+#endif
+  kmem_cache_free(bcache.cache, b);
+  acquire(&bcache.lock);
+  bcache.nbuf--;
+  release(&bcache.lock);
+}
+
 void
 binit(void)
 {
+  struct bucket *bk;
   struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  if((bcache.cache = kmem_cache_create("buf", sizeof(struct buf))) == 0)
+    panic("binit");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Spread the first buffers over the buckets.
+  for(i = 0; i < NBUF; i++){
+    if((b = bnew()) == 0)
+      panic("binit: out of memory");
+    bfront(&bcache.bucket[i % NBUCKET], b);
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Find the cached buffer for a block. Caller holds bk->lock.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
+  for(b = bk->head.next; b != &bk->head; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Find the cached buffer for a block and take a reference.
+// Caller holds bk->lock.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bfind(bk, dev, blockno)) != 0)
+    b->refcnt++;
+  return b;
+}
+
+// Take the least recently used free buffer out of some bucket.
+// Even if refcnt==0, B_DIRTY indicates a buffer is in use
+// because log.c has modified it but not yet committed it.
+// The buffer is in no bucket and its contents are invalid.
+// Returns 0 if every buffer is in use.
+static struct buf*
+bsteal(void)
+{
+  struct bucket *bk;
+  struct buf *b;
+  int i;
+
+  for(i = 0; i < NBUCKET; i++){
+    bk = &bcache.bucket[(bcache.hand + i) % NBUCKET];
+    acquire(&bk->lock);
+    for(b = bk->head.prev; b != &bk->head; b = b->prev){
+      if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+        bunlink(b);
+        // Forget the old block, so that if the buffer is parked
+        // in a bucket unused it cannot be found as that block.
+        b->flags = 0;
+        b->dev = -1;
+        b->blockno = 0;
+        release(&bk->lock);
+        bcache.hand = (bcache.hand + i + 1) % NBUCKET;
+        return b;
+      }
+    }
+    release(&bk->lock);
+  }
+  return 0;
+}
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
+// Free up to n unused buffers, keeping at least NBUF.
+// Returns the number freed.
+int
+bshrink(int n)
+{
+  struct buf *b;
+  int got;
+
+  for(got = 0; got < n; got++){
+    acquire(&bcache.lock);
+    if(bcache.nbuf <= NBUF){
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      break;
     }
+    release(&bcache.lock);
+    if((b = bsteal()) == 0)
+      break;
+    bdestroy(b);
   }
+  return got;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b, *nb;
+  int evict;
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  if(b){
+    bk->hits++;
+    release(&bk->lock);
+  } else {
+    bk->misses++;
+    release(&bk->lock);
+    // Not cached: grow the cache while memory is plentiful,
+    // otherwise recycle an unused buffer. Another process may
+    // have cached the block meanwhile, in which case the new
+    // buffer, whose contents are invalid, just joins this bucket.
+    evict = 0;
+    nb = 0;
+    if(!klowmem(BCRESERVE))
+      nb = bnew();
+    if(nb == 0 && (nb = bsteal()) != 0)
+      evict = 1;
+    if(nb == 0 && (nb = bnew()) == 0)
+      panic("bget: no buffers");
+    acquire(&bk->lock);
+    bk->evicts += evict;
+    if((b = blookup(bk, dev, blockno)) == 0){
+      b = nb;
       b->dev = dev;
       b->blockno = blockno;
-      b->flags = 0;
       b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+      bfront(bk, b);
+    } else
+      bfront(bk, nb);
+    release(&bk->lock);
   }
-  panic("bget: no buffers");
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,6 +288,40 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Copy the contents of a block to dst without caching it.
+// A copy already in the cache is used, since it may be newer
+// than the disk; otherwise the block is read straight into dst
+// through a buffer that never enters the cache. Used by the page cache
+// so that big file reads do not evict metadata.
+void
+breadraw(uint dev, uint blockno, char *dst)
+{
+  struct bucket *bk;
+  struct buf *b, rb;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    acquiresleep(&b->lock);
+    if((b->flags & B_VALID) == 0)
+      iderw(b);
+    memmove(dst, b->data, BSIZE);
+    brelse(b);
+    return;
+  }
+
+  memset(&rb, 0, sizeof(rb));
+  initsleeplock(&rb.lock, "rawbuf");
+  acquiresleep(&rb.lock);
+  rb.dev = dev;
+  rb.blockno = blockno;
+  rb.data = (uchar*)dst;
+  iderw(&rb);
+  releasesleep(&rb.lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,6 +332,24 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Drop a reference to b, moving it to the head of the MRU list
+// of its bucket if it was the last.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    bunlink(b);
+    bfront(bk, b);
+  }
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
 // Move to the head of the MRU list.
 void
@@ -124,21 +359,74 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+// Whether the buffer cache holds block blockno.
+int
+bcached(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  return b != 0;
+}
+
+// Start reading a block into the cache without waiting for it,
+// unless it is cached already. The buffer stays locked until the
+// disk driver hands it to basyncdone(). Used for directories and
+// other metadata; file data is read ahead into the page cache.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if(bcached(dev, blockno))
+    return;
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  b->flags |= B_ASYNC;
+  iderw(b);
+}
+
+// Release a read-ahead buffer once the disk has filled it.
+// Called from the disk interrupt, which is not the lock holder.
+void
+basyncdone(struct buf *b)
+{
+  if(b->flags & B_PAGE){
+    pcacheiodone(b);
+    return;
   }
-  
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// Report the size and use of the buffer cache.
+void
+bstat(struct memstat *ms)
+{
+  struct bucket *bk;
+
+  acquire(&bcache.lock);
+  ms->bufs = bcache.nbuf;
   release(&bcache.lock);
+  ms->bufpages = (ms->bufs * (BSIZE + sizeof(struct buf)) + PGSIZE-1) / PGSIZE;
+  ms->bhits = ms->bmisses = ms->bevicts = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    ms->bhits += bk->hits;
+    ms->bmisses += bk->misses;
+    ms->bevicts += bk->evicts;
+    release(&bk->lock);
+  }
 }
 //PAGEBREAK!
 // Blank page.
-
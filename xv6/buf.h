@@ -7,8 +7,11 @@ struct buf {
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  uchar *data;       // BSIZE bytes
+  struct cpage *page; // B_PAGE: page cache entry it reads into
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // read-ahead: nobody waits; released when done
+#define B_PAGE  0x10 // read-ahead into a page cache page
 
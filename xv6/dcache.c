@@ -0,0 +1,186 @@
+// Directory entry cache for path name lookup.
+//
+// Maps (dev, directory inum, name) to the inode number the
+// name refers to, or to 0 when the directory has no such
+// name (a negative entry). namex() consults it before locking
+// a directory and reading its blocks.
+//
+// dirlookup() and dirlink() add entries, and unlink turns
+// its entry negative, all while holding the directory's
+// sleep-lock, so the cache agrees with the directory. When a
+// directory inode is freed its entries are purged, since its
+// inode number will be reused. Entries are recycled in least
+// recently used order.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDCHASH 61  // hash buckets
+
+struct dentry {
+  uint dev;
+  uint dinum;            // directory holding the name
+  char name[DIRSIZ];
+  uint inum;             // 0 if name is not there
+  struct dentry *hnext;  // hash chain, or unused list
+  struct dentry *prev;   // LRU list, most recent first
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry entry[NDENTRY];
+  struct dentry *hash[NDCHASH];
+  struct dentry lru;       // head of LRU list of hashed entries
+  struct dentry *free;     // unused entries
+} dcache;
+
+void
+dcacheinit(void)
+{
+  int i;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.next = dcache.lru.prev = &dcache.lru;
+  for(i = 0; i < NDENTRY; i++){
+    dcache.entry[i].hnext = dcache.free;
+    dcache.free = &dcache.entry[i];
+  }
+}
+
+static uint
+dchash(uint dev, uint dinum, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 33 + (uchar)name[i];
+  return h % NDCHASH;
+}
+
+static void
+lrudel(struct dentry *d)
+{
+  d->prev->next = d->next;
+  d->next->prev = d->prev;
+}
+
+static void
+lrufront(struct dentry *d)
+{
+  d->next = dcache.lru.next;
+  d->prev = &dcache.lru;
+  dcache.lru.next->prev = d;
+  dcache.lru.next = d;
+}
+
+// Remove d from the hash table and LRU list.
+// Caller holds dcache.lock.
+static void
+dcunlink(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dchash(d->dev, d->dinum, d->name)]; *pp != d;
+      pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  lrudel(d);
+}
+
+// Caller holds dcache.lock.
+static struct dentry*
+dcfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dchash(dev, dinum, name)]; d; d = d->hnext){
+    if(d->dev == dev && d->dinum == dinum &&
+       strncmp(d->name, name, DIRSIZ) == 0){
+      lrudel(d);
+      lrufront(d);
+      return d;
+    }
+  }
+  return 0;
+}
+
+// Look up name in directory dp, which the caller need not lock.
+// Returns 1 and sets *ipp to the inode, unlocked and referenced,
+// or to 0 if the cache knows the name is not there.
+// Returns 0 if the cache does not know.
+int
+dclookup(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  // Taking the reference under dcache.lock keeps a
+  // concurrent unlink from freeing the inode first.
+  *ipp = d->inum ? iget(dp->dev, d->inum) : 0;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp refers to inum,
+// or to nothing if inum is 0. Caller holds dp->lock.
+void
+dcenter(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) != 0){
+    d->inum = inum;
+    release(&dcache.lock);
+    return;
+  }
+  if((d = dcache.free) != 0)
+    dcache.free = d->hnext;
+  else {
+    d = dcache.lru.prev;
+    dcunlink(d);
+  }
+  d->dev = dp->dev;
+  d->dinum = dp->inum;
+  strncpy(d->name, name, DIRSIZ);
+  d->inum = inum;
+  h = dchash(d->dev, d->dinum, d->name);
+  d->hnext = dcache.hash[h];
+  dcache.hash[h] = d;
+  lrufront(d);
+  release(&dcache.lock);
+}
+
+// Drop the entries of directory dp, which is being freed.
+void
+dcpurge(struct inode *dp)
+{
+  struct dentry *d, *next;
+  int i;
+
+  acquire(&dcache.lock);
+  for(i = 0; i < NDCHASH; i++){
+    for(d = dcache.hash[i]; d; d = next){
+      next = d->hnext;
+      if(d->dev != dp->dev || d->dinum != dp->inum)
+        continue;
+      dcunlink(d);
+      d->hnext = dcache.free;
+      dcache.free = d;
+    }
+  }
+  release(&dcache.lock);
+}
@@ -12,12 +12,21 @@ struct stat;
 struct superblock;
 struct sharedmem;
 struct page;
+struct vma;
+struct kmem_cache;
+struct memstat;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadraw(uint, uint, char*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bstat(struct memstat*);
+int             bshrink(int);
+void            breadahead(uint, uint);
+int             bcached(uint, uint);
+void            basyncdone(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -25,8 +34,16 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
+// dcache.c
+void            dcacheinit(void);
+int             dclookup(struct inode*, char*, struct inode**);
+void            dcenter(struct inode*, char*, uint);
+void            dcpurge(struct inode*);
+
 // exec.c
 int             exec(char*, char**);
+int             loadprog(char*, char**, pde_t**, uint*, uint*, uint*,
+                         struct vma*);
 
 // file.c
 struct file*    filealloc(void);
@@ -43,6 +60,8 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+struct inode*   iget(uint, uint);
+void            icacheinit(void);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -52,6 +71,8 @@ void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
+uint            bmap(struct inode*, uint);
+uint            bmaprun(struct inode*, uint, uint, uint*);
 int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
@@ -68,15 +89,25 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kallocpages(int);
+char*           kdup(char*);
 void            kfree(char*);
+int             krefcnt(char*);
+char*           kzalloc(void);
+int             kzeroidle(void);
+int             klowmem(int);
+int             kcommit(int);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kmemstat(struct memstat*);
+extern uint     phystop;
 
 // kbd.c
 void            kbdintr(void);
 
 // lapic.c
 void            cmostime(struct rtcdate *r);
+uint            cmosmemsize(void);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
@@ -89,6 +120,7 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            logsync(void);
 
 // mp.c
 extern int      ismp;
@@ -98,23 +130,42 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pcache.c
+void            pcacheinit(void);
+int             pcacheread(struct inode*, char*, uint, uint);
+char*           pcachemap(struct inode*, uint);
+void            pcachewrite(struct inode*, char*, uint, uint);
+void            pcachedrop(struct inode*);
+int             pcachehas(struct inode*, uint);
+void            pcachereadahead(struct inode*, uint);
+void            pcacheiodone(struct buf*);
+int             pcachereclaim(int);
+void            pcachestat(struct memstat*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipecount(void);
 
 //PAGEBREAK: 16
 // proc.c
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             spawn(char*, char**, int*);
 int             growproc(int);
+struct proc*    kthread(char*, void(*)(void));
+char*           swappick(uint);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
+void            procmemstat(struct memstat*);
+pde_t*          replaceuvm(struct proc*, pde_t*, uint);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
@@ -139,6 +190,16 @@ void p_release(struct prioritylock *);
 void pushcli(void);
 void popcli(void);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void*           kmalloc(uint);
+void            kmfree(void*);
+int             kmem_cache_inuse(struct kmem_cache*);
+void            slabstat(struct memstat*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -154,9 +215,18 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(void);
+void            swapfree(uint);
+void            swapdup(uint);
+void            swapread(uint, char*);
+void            swapwait(void);
+void            swapstat(struct memstat*);
+int             swapavail(void);
+
 // syscall.c
 int argint(int, int *);
-int argptr(int, char **, int);
+int argptr(int, char **, int, int);
 int argstr(int, char **);
 int fetchint(uint, int *);
 int fetchstr(uint, char **);
@@ -189,8 +259,20 @@ int loaduvm(pde_t *, char *, struct inode *, uint, uint);
 pde_t *copyuvm(pde_t *, uint);
 void switchuvm(struct proc *);
 void switchkvm(void);
+void resumeuvm(struct proc *);
 int copyout(pde_t *, uint, void *, uint);
 void clearpteu(pde_t *pgdir, char *uva);
+int pagefault(struct proc *, uint, uint);
+int uvmtouch(struct proc *, uint, uint, int);
+int vmadup(struct proc *, struct proc *);
+void vmasync(struct proc *);
+uint mmap(struct proc *, struct inode *, uint, uint, int, int);
+int munmap(struct proc *, uint, uint);
+uint uvmlimit(struct proc *, uint);
+uint uvmuntouched(pde_t *, uint, uint);
+void vmafree(struct vma *);
+uint uvmrss(pde_t *, uint *);
+char* uvmevict(struct proc *, uint *, uint);
 
 // utyls
 void utylinit(void);
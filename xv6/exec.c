@@ -6,18 +6,24 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "fcntl.h"
 
+// Build a new user image for the program at path, with
+// arguments argv, without touching the current process.
+// On success fills in *pgdirp, *szp, *entryp, *spp and the
+// segment vmas in vma[NVMA], and returns 0.
 int
-exec(char *path, char **argv)
+loadprog(char *path, char **argv, pde_t **pgdirp, uint *szp,
+         uint *entryp, uint *spp, struct vma *vma)
 {
-  char *s, *last;
-  int i, off;
+  int i, off, nvma;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  pde_t *pgdir;
+
+  memset(vma, 0, NVMA*sizeof(struct vma));
 
   begin_op();
 
@@ -38,8 +44,10 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map the program's segments. Nothing is read yet:
+  // pagefault() reads each page from ip on first touch.
   sz = 0;
+  nvma = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -49,12 +57,22 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz >= MMAPBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nvma >= NVMA)
       goto bad;
+    vma[nvma].start = ph.vaddr;
+    vma[nvma].end = ph.vaddr + ph.memsz;
+    vma[nvma].ip = idup(ip);
+    vma[nvma].off = ph.off;
+    vma[nvma].filesz = ph.filesz;
+    vma[nvma].prot = PROT_READ|PROT_WRITE;
+    vma[nvma].flags = MAP_PRIVATE;
+    nvma++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
@@ -87,6 +105,37 @@ exec(char *path, char **argv)
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
+  *pgdirp = pgdir;
+  *szp = sz;
+  *entryp = elf.entry;
+  *spp = sp;
+  return 0;
+
+ bad:
+  if(pgdir)
+    freevm(pgdir);
+  if(ip){
+    iunlockput(ip);
+    end_op();
+  }
+  begin_op();
+  vmafree(vma);
+  end_op();
+  return -1;
+}
+
+int
+exec(char *path, char **argv)
+{
+  char *s, *last;
+  uint sz, sp, entry;
+  struct vma vma[NVMA];
+  pde_t *pgdir, *oldpgdir;
+  struct proc *curproc = myproc();
+
+  if(loadprog(path, argv, &pgdir, &sz, &entry, &sp, vma) < 0)
+    return -1;
+
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
@@ -94,21 +143,17 @@ exec(char *path, char **argv)
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
+  vmasync(curproc);
+  oldpgdir = replaceuvm(curproc, pgdir, sz);
+  curproc->tf->eip = entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
   freevm(oldpgdir);
+  kcommit(-curproc->ncommit);
+  curproc->ncommit = 0;
+  begin_op();
+  vmafree(curproc->vma);
+  end_op();
+  memmove(curproc->vma, vma, sizeof(vma));
   return 0;
-
- bad:
-  if(pgdir)
-    freevm(pgdir);
-  if(ip){
-    iunlockput(ip);
-    end_op();
-  }
-  return -1;
 }
@@ -22,7 +22,16 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint ranext;        // block a sequential read would read next
+  uint raend;         // blocks below this have been read ahead
+  uint rawin;         // read-ahead window, in blocks
+  uint agoal;         // where to look for this file's next block
+
+  struct inode *hnext; // icache hash chain
+  struct inode *prev;  // icache LRU list of unreferenced inodes
+  struct inode *next;
 };
 
 // table mapping major device number to
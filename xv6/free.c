@@ -0,0 +1,46 @@
+// Report memory usage: free [-v]
+// -v also lists the kernel slab caches.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+#define KB(pages) ((pages) * 4)
+
+struct memstat ms;  // too big for the one-page user stack
+
+int
+main(int argc, char *argv[])
+{
+  int i, verbose;
+
+  verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+  if(memstat(&ms) < 0){
+    printf(2, "free: memstat failed\n");
+    exit();
+  }
+
+  printf(1, "total %d KB, used %d KB, free %d KB (%d KB zeroed)\n",
+         KB(ms.total), KB(ms.total - ms.free), KB(ms.free), KB(ms.zeroed));
+  printf(1, "page tables %d KB, slabs %d KB, shared memory %d KB\n",
+         KB(ms.ptpages), KB(ms.slabpages), KB(ms.shmpages));
+  printf(1, "swap %d KB used of %d KB\n",
+         KB(ms.swapused), KB(ms.swaptotal));
+  printf(1, "buffer cache %d bufs %d KB, %d hits %d misses %d evictions\n",
+         ms.bufs, KB(ms.bufpages), ms.bhits, ms.bmisses, ms.bevicts);
+  printf(1, "page cache %d KB, pipes %d\n", KB(ms.cachepages), ms.pipes);
+
+  printf(1, "\npid\tsize\trss\tptab\tname\n");
+  for(i = 0; i < ms.nproc; i++)
+    printf(1, "%d\t%d\t%d\t%d\t%s\n", ms.proc[i].pid, ms.proc[i].sz / 1024,
+           KB(ms.proc[i].rss), KB(ms.proc[i].ptpages), ms.proc[i].name);
+
+  if(verbose){
+    printf(1, "\ncache\tsize\tinuse\tpages\n");
+    for(i = 0; i < ms.nslab; i++)
+      printf(1, "%s\t%d\t%d\t%d\n", ms.slab[i].name, ms.slab[i].size,
+             ms.slab[i].inuse, ms.slab[i].npages);
+  }
+  exit();
+}
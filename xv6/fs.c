@@ -22,6 +22,8 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define RAMIN  4    // first read-ahead window, in blocks
+#define RAMAX  64   // largest read-ahead window
 static void itrunc(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
@@ -51,26 +53,83 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// The disk is divided into allocation groups of BGROUP blocks,
+// and bsum keeps the number of free blocks in each, counted
+// from the bitmap when the file system is mounted. balloc()
+// starts at a goal block, normally just past the block the
+// inode got last, and skips groups that have nothing free.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+#define BGROUP 1024  // blocks per allocation group; divides BPB
+
+struct {
+  struct spinlock lock;
+  uint ngroup;
+  uint *nfree;       // free blocks in each group
+} bsum;
+
+// Count the free blocks of each group.
+static void
+bsuminit(uint dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, bi;
 
-  bp = 0;
+  initlock(&bsum.lock, "bsum");
+  bsum.ngroup = (sb.size + BGROUP - 1) / BGROUP;
+  if((bsum.nfree = kmalloc(bsum.ngroup * sizeof(uint))) == 0)
+    panic("bsuminit");
+  memset(bsum.nfree, 0, bsum.ngroup * sizeof(uint));
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[(b + bi) / BGROUP]++;
+    brelse(bp);
+  }
+}
+
+// Allocate up to n zeroed disk blocks in a row, starting with
+// the first free block at or after goal. Sets *got to the
+// number allocated, at least 1, and returns the first.
+static uint
+balloc(uint dev, uint goal, uint n, uint *got)
+{
+  uint g, i, b, bi, end;
+  struct buf *bp;
+
+  if(goal >= sb.size)
+    goal = 0;
+  g = goal / BGROUP;
+  // Visit goal's group twice, in case its free blocks are below goal.
+  for(i = 0; i <= bsum.ngroup; i++, g = (g + 1) % bsum.ngroup, goal = g*BGROUP){
+    if(bsum.nfree[g] == 0)
+      continue;
+    end = min((g + 1) * BGROUP, sb.size);
+    bp = bread(dev, BBLOCK(goal, sb));
+    for(b = goal; b < end; b++){
+      bi = b % BPB;
+      if(bp->data[bi/8] == 0xff && bi % 8 == 0){  // skip full bytes
+        b += 7;
+        continue;
+      }
+      if((bp->data[bi/8] & (1 << (bi % 8))) != 0)
+        continue;
+      // Block b is free: take it and the free blocks after it.
+      for(*got = 0; *got < n && b + *got < end; (*got)++){
+        bi = (b + *got) % BPB;
+        if(bp->data[bi/8] & (1 << (bi % 8)))
+          break;
+        bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
       }
+      log_write(bp);
+      brelse(bp);
+      acquire(&bsum.lock);
+      bsum.nfree[g] -= *got;
+      release(&bsum.lock);
+      for(i = 0; i < *got; i++)
+        bzero(dev, b + i);
+      return b;
     }
     brelse(bp);
   }
@@ -92,6 +151,9 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  acquire(&bsum.lock);
+  bsum.nfree[b / BGROUP]++;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -119,18 +181,20 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a cache entry and
+//   increments its ref; iput() decrements ref. An entry whose
+//   ref is zero stays cached, on an LRU list, until iget()
+//   recycles it for another inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode. An unreferenced
+//   entry stays valid, so iget() of a recently used inode
+//   does not read the disk again.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -154,38 +218,53 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// Cache entries are found through a hash table on (dev, inum)
+// and come from a slab cache. The cache grows while more than
+// 1/ICRESERVE of memory is free, or while it holds fewer than
+// NINODE entries; otherwise iget() recycles the least recently
+// used unreferenced entry.
+//
 // The icache.lock spin-lock protects the allocation of icache
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// holds, one must hold icache.lock while using any of those fields,
+// or the hash and LRU links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH    61  // hash buckets
+#define ICRESERVE 8   // grow while over 1/ICRESERVE of memory is free
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode lru;          // unreferenced inodes, most recent first
+  int ninode;
+  struct kmem_cache *cache;
 } icache;
 
 void
-iinit(int dev)
+icacheinit(void)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.lru.prev = icache.lru.next = &icache.lru;
+  if((icache.cache = kmem_cache_create("inode", sizeof(struct inode))) == 0)
+    panic("icacheinit");
+}
 
+void
+iinit(int dev)
+{
   readsb(dev, &sb);
+  bsuminit(dev);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
           sb.bmapstart);
 }
 
-static struct inode* iget(uint dev, uint inum);
 
 //PAGEBREAK!
 // Allocate an inode on device dev.
@@ -235,37 +314,88 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+static uint
+ihash(uint dev, uint inum)
+{
+  return (dev * 31 + inum) % NIHASH;
+}
+
+static void
+lrudel(struct inode *ip)
+{
+  ip->prev->next = ip->next;
+  ip->next->prev = ip->prev;
+}
+
+static void
+lrufront(struct inode *ip)
+{
+  ip->next = icache.lru.next;
+  ip->prev = &icache.lru;
+  icache.lru.next->prev = ip;
+  icache.lru.next = ip;
+}
+
+// Allocate a cache entry, in no hash chain.
+// Returns 0 if out of memory. Caller holds icache.lock.
+static struct inode*
+inew(void)
+{
+  struct inode *ip;
+
+  if((ip = kmem_cache_alloc(icache.cache)) == 0)
+    return 0;
+  memset(ip, 0, sizeof(*ip));
+  initsleeplock(&ip->lock, "inode");
+  icache.ninode++;
+  return ip;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
-static struct inode*
+struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
+  uint h;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  h = ihash(dev, inum);
+  for(ip = icache.hash[h]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lrudel(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Make a new entry, or recycle an unreferenced one.
+  ip = 0;
+  if(icache.ninode < NINODE || !klowmem(ICRESERVE) ||
+     icache.lru.prev == &icache.lru)
+    ip = inew();
+  if(ip == 0){
+    if((ip = icache.lru.prev) == &icache.lru)
+      panic("iget: no inodes");
+    lrudel(ip);
+    for(pp = &icache.hash[ihash(ip->dev, ip->inum)]; *pp != ip;
+        pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = ip->raend = ip->rawin = 0;
+  ip->agoal = 0;
+  ip->hnext = icache.hash[h];
+  icache.hash[h] = ip;
   release(&icache.lock);
 
   return ip;
@@ -339,6 +469,8 @@ iput(struct inode *ip)
     if(r == 1){
       // inode has no links and no other references: truncate and free.
       itrunc(ip);
+      if(ip->type == T_DIR)
+        dcpurge(ip);
       ip->type = 0;
       iupdate(ip);
       ip->valid = 0;
@@ -347,7 +479,8 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0)
+    lrufront(ip);
   release(&icache.lock);
 }
 
@@ -365,38 +498,168 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  The NDINDIRECT blocks
+// after those are reached through ip->addrs[NDIRECT+1], a
+// block of NINDIRECT indirect block numbers.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Allocate a block for ip, just after the last one it got.
+// A new file starts in a group picked by its inode number,
+// which spreads files out and leaves them room to grow.
 static uint
-bmap(struct inode *ip, uint bn)
+iballoc(struct inode *ip)
+{
+  uint b, got;
+
+  if(ip->agoal == 0)
+    ip->agoal = (ip->inum % bsum.ngroup) * BGROUP;
+  b = balloc(ip->dev, ip->agoal, 1, &got);
+  ip->agoal = b + 1;
+  return b;
+}
+
+// Return entry i of indirect block blk. If it is empty and
+// alloc is set, store fill in it, or a new block if fill is 0.
+static uint
+indirect(struct inode *ip, uint blk, uint i, int alloc, uint fill)
 {
   uint addr, *a;
   struct buf *bp;
 
+  bp = bread(ip->dev, blk);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0 && alloc){
+    a[i] = addr = fill ? fill : iballoc(ip);
+    log_write(bp);
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Find the indirect block that maps bn and bn's index in it.
+// Returns 0 if there is none and alloc is clear.
+static uint
+indirblock(struct inode *ip, uint bn, uint *i, int alloc)
+{
+  uint addr;
+
+  bn -= NDIRECT;
+  if(bn < NINDIRECT){
+    *i = bn;
+    if((addr = ip->addrs[NDIRECT]) == 0 && alloc)
+      ip->addrs[NDIRECT] = addr = iballoc(ip);
+    return addr;
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    *i = bn % NINDIRECT;
+    if((addr = ip->addrs[NDIRECT+1]) == 0){
+      if(!alloc)
+        return 0;
+      ip->addrs[NDIRECT+1] = addr = iballoc(ip);
+    }
+    return indirect(ip, addr, bn / NINDIRECT, alloc, 0);
+  }
+
+  panic("bmap: out of range");
+}
+
+// Return the disk block address of block bn of ip. If it has
+// none, give it block fill, or a new block if fill is 0.
+static uint
+bmapfill(struct inode *ip, uint bn, uint fill)
+{
+  uint addr, i;
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = fill ? fill : iballoc(ip);
     return addr;
   }
-  bn -= NDIRECT;
+  addr = indirblock(ip, bn, &i, 1);
+  return indirect(ip, addr, i, 1, fill);
+}
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one.
+uint
+bmap(struct inode *ip, uint bn)
+{
+  return bmapfill(ip, bn, 0);
+}
+
+// Give blocks bn..last of ip, which have none yet, runs of
+// blocks that follow one another on disk, starting next to
+// block bn-1. Caller holds ip->lock.
+static void
+bmapextend(struct inode *ip, uint bn, uint last)
+{
+  uint addr, got, run, i;
+
+  if(bn > 0 && (addr = bmaprun(ip, bn - 1, 1, &run)) != 0)
+    ip->agoal = addr + 1;
+  else if(ip->agoal == 0)
+    ip->agoal = (ip->inum % bsum.ngroup) * BGROUP;
+  for(; bn <= last; bn += got){
+    addr = balloc(ip->dev, ip->agoal, last - bn + 1, &got);
+    ip->agoal = addr + got;
+    for(i = 0; i < got; i++)
+      bmapfill(ip, bn + i, addr + i);
+  }
+}
+
+// Map up to n blocks of ip starting at bn, without allocating.
+// Returns the disk address of block bn, or 0 if it has none,
+// and sets *run to the number of blocks from bn on that lie
+// one after another on disk. One indirect block lookup maps
+// the whole run.
+uint
+bmaprun(struct inode *ip, uint bn, uint n, uint *run)
+{
+  uint addr, i, lim, *a;
+  struct buf *bp;
+
+  *run = 0;
+  bp = 0;
+  if(bn < NDIRECT){
+    a = ip->addrs;
+    i = bn;
+    lim = NDIRECT;
+  } else {
+    if(bn >= MAXFILE || (addr = indirblock(ip, bn, &i, 0)) == 0)
+      return 0;
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+    lim = NINDIRECT;
+  }
+  if((addr = a[i]) != 0)
+    for(*run = 1; *run < n && i + *run < lim; (*run)++)
+      if(a[i + *run] != addr + *run)
+        break;
+  if(bp)
+    brelse(bp);
+  return addr;
+}
+
+// Free indirect block blk and, below it, depth more levels
+// of blocks.
+static void
+indirfree(struct inode *ip, uint blk, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  if(depth > 0){
+    bp = bread(ip->dev, blk);
+    a = (uint*)bp->data;
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j])
+        indirfree(ip, a[j], depth - 1);
     }
     brelse(bp);
-    return addr;
   }
-
-  panic("bmap: out of range");
+  bfree(ip->dev, blk);
 }
 
 // Truncate inode (discard contents).
@@ -407,10 +670,9 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
+  pcachedrop(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -419,16 +681,13 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    indirfree(ip, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
+  if(ip->addrs[NDIRECT+1]){
+    indirfree(ip, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
 
   ip->size = 0;
   iupdate(ip);
@@ -446,13 +705,58 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read-ahead for a read of blocks bn..last of ip. A read that
+// goes on from where the previous one stopped grows the window, up to
+// RAMAX blocks; any other read halves it. Blocks in the window
+// past last are queued to the disk without waiting, skipping
+// those already read ahead: a regular file's into page cache
+// pages, anything else's into the buffer cache.
+// Caller holds ip->lock.
+static void
+readahead(struct inode *ip, uint bn, uint last)
+{
+  uint b, end, addr, run, i;
+
+  // Small reads, like dirlookup()'s, stay in one block a while.
+  if(bn + 1 == ip->ranext && last + 1 == ip->ranext)
+    return;
+  if(bn == ip->ranext || bn + 1 == ip->ranext)
+    ip->rawin = ip->rawin ? min(2*ip->rawin, RAMAX) : RAMIN;
+  else {
+    ip->rawin /= 2;
+    ip->raend = 0;
+  }
+  ip->ranext = last + 1;
+
+  end = min(last + 1 + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  b = last + 1;
+  if(b < ip->raend)
+    b = ip->raend;
+  if(ip->type == T_FILE){
+    // File data goes to the page cache, not the buffer cache.
+    for(i = b*BSIZE / PGSIZE; i < (end*BSIZE + PGSIZE - 1) / PGSIZE; i++)
+      pcachereadahead(ip, i);
+  } else {
+    for(; b < end; b += run){
+      if((addr = bmaprun(ip, b, end - b, &run)) == 0){
+        run = 1;
+        continue;
+      }
+      for(i = 0; i < run; i++)
+        breadahead(ip->dev, addr + i);
+    }
+  }
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, run;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -465,10 +769,27 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
-
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+  if(n > 0)
+    readahead(ip, off/BSIZE, (off + n - 1)/BSIZE);
+
+  // Regular files go through the page cache; whatever it
+  // has no room for is read through the buffer cache.
+  tot = 0;
+  if(ip->type == T_FILE)
+    tot = pcacheread(ip, dst, off, n);
+
+  run = 0;
+  for(off+=tot, dst+=tot; tot<n; tot+=m, off+=m, dst+=m){
+    if(run == 0)
+      addr = bmaprun(ip, off/BSIZE, (off%BSIZE + n - tot - 1)/BSIZE + 1, &run);
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(addr == 0){
+      // A hole, as a hashed directory has: reads as zeroes.
+      memset(dst, 0, m);
+      continue;
+    }
+    bp = bread(ip->dev, addr++);
+    run--;
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
   }
@@ -492,9 +813,14 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(n > 0 && (off + n - 1)/BSIZE >= MAXFILE)
     return -1;
 
+  // Blocks appended to a regular file are allocated together,
+  // so a file written sequentially lies in runs on disk.
+  if(ip->type == T_FILE && n > 0 && off + n > ip->size)
+    bmapextend(ip, (ip->size + BSIZE - 1)/BSIZE, (off + n - 1)/BSIZE);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -502,6 +828,8 @@ writei(struct inode *ip, char *src, uint off, uint n)
     log_write(bp);
     brelse(bp);
   }
+  if(ip->type == T_FILE)
+    pcachewrite(ip, src - n, off - n, n);
 
   if(n > 0 && off > ip->size){
     ip->size = off;
@@ -519,18 +847,43 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
-// Look for a directory entry in a directory.
-// If found, set *poff to byte offset of entry.
-struct inode*
-dirlookup(struct inode *dp, char *name, uint *poff)
+// Hash a directory entry name (FNV-1a).
+static uint
+dirhash(char *name)
 {
-  uint off, inum;
-  struct dirent de;
+  uint h;
+  int i;
 
-  if(dp->type != T_DIR)
-    panic("dirlookup not DIR");
+  h = 2166136261U;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Byte offset of the first block of name's hash bucket.
+static uint
+dirbucket(char *name)
+{
+  return (1 + dirhash(name) % NDIRHASH) * BSIZE;
+}
+
+// Does directory dp have a block holding byte offset off?
+static int
+dirhasblock(struct inode *dp, uint off)
+{
+  uint run;
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  return off < dp->size && bmaprun(dp, off/BSIZE, 1, &run) != 0;
+}
+
+// Search the entries in [off, end) of dp for name.
+// If found, set *poff to its offset and return its inode number.
+static uint
+dirscan(struct inode *dp, char *name, uint off, uint end, uint *poff)
+{
+  struct dirent de;
+
+  for(; off < end; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
     if(de.inum == 0)
@@ -539,19 +892,57 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       // entry matches path element
       if(poff)
         *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+      return de.inum;
     }
   }
-
   return 0;
 }
 
+// Return the offset of the first free entry in [off, end)
+// of dp, or -1 if there is none.
+static int
+dirfree(struct inode *dp, uint off, uint end)
+{
+  struct dirent de;
+
+  for(; off < end; off += sizeof(de)){
+    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirlink read");
+    if(de.inum == 0)
+      return off;
+  }
+  return -1;
+}
+
+// Look for a directory entry in a directory.
+// If found, set *poff to byte offset of entry.
+// A hashed directory costs a scan of block 0 and of
+// the blocks in one bucket.
+struct inode*
+dirlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint off, inum;
+
+  if(dp->type != T_DIR)
+    panic("dirlookup not DIR");
+
+  if(dp->major != DIR_HASHED)
+    inum = dirscan(dp, name, 0, dp->size, poff);
+  else if((inum = dirscan(dp, name, 0, BSIZE, poff)) == 0){
+    for(off = dirbucket(name); dirhasblock(dp, off); off += NDIRHASH*BSIZE)
+      if((inum = dirscan(dp, name, off, off + BSIZE, poff)) != 0)
+        break;
+  }
+  dcenter(dp, name, inum);
+  return inum ? iget(dp->dev, inum) : 0;
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  int off, grow;
+  uint b;
   struct dirent de;
   struct inode *ip;
 
@@ -561,18 +952,42 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  // Look for an empty dirent, first in block 0.
+  if(dp->major != DIR_HASHED){
+    if((off = dirfree(dp, 0, dp->size)) < 0)
+      off = dp->size;
+    if(off == BSIZE){
+      // Block 0 is full: index the rest of the directory.
+      dp->major = DIR_HASHED;
+      iupdate(dp);
+      off = -1;
+    }
+  } else
+    off = dirfree(dp, 0, BSIZE);
+
+  // Then in name's bucket, adding a block to it if it is full.
+  grow = 0;
+  if(dp->major == DIR_HASHED && off < 0){
+    for(b = dirbucket(name); dirhasblock(dp, b); b += NDIRHASH*BSIZE)
+      if((off = dirfree(dp, b, b + BSIZE)) >= 0)
+        break;
+    if(off < 0){
+      // The new block leaves a hole below it unless
+      // the chain ends right at the end of the file.
+      off = b;
+      if(dp->size < b + BSIZE)
+        dp->size = b + BSIZE;
+      grow = 1;
+    }
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcenter(dp, name, inum);
+  if(grow)
+    iupdate(dp);
 
   return 0;
 }
@@ -632,6 +1047,14 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    // The dentry cache can answer without locking ip.
+    if((!nameiparent || *path != '\0') && dclookup(ip, name, &next)){
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
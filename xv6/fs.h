@@ -3,11 +3,11 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define BSIZE 4096  // block size, one page
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                             free bit map | data blocks | swap area ]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -19,11 +19,17 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of first swap block
+  uint nswap;        // Number of pages in the swap area
 };
 
-#define NDIRECT 12
+#define SWAPBPP    (4096 / BSIZE)         // blocks per swapped page
+#define SWAPBLOCKS (SWAPSIZE * SWAPBPP)   // blocks in the swap area
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +38,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -55,3 +61,11 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory starts as a plain list of dirents in block 0.
+// Once that block is full, major is set to DIR_HASHED and further
+// entries go in NDIRHASH hash buckets: bucket b is the chain of
+// blocks 1+b, 1+b+NDIRHASH, 1+b+2*NDIRHASH, ..., ending at the
+// first block that has not been allocated.
+#define DIR_HASHED 1
+#define NDIRHASH   64
+
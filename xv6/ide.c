@@ -23,6 +23,7 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
@@ -65,6 +66,13 @@ ideinit(void)
     }
   }
 
+  // Have READ/WRITE MULTIPLE move a whole block per interrupt.
+  if(havedisk1 && BSIZE > SECTOR_SIZE){
+    outb(0x1f2, BSIZE/SECTOR_SIZE);
+    outb(0x1f7, IDE_CMD_SETMUL);
+    idewait(0);
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
@@ -75,15 +83,13 @@ idestart(struct buf *b)
 {
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  if(b->blockno >= FSSIZE + SWAPBLOCKS)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
-
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
   outb(0x1f2, sector_per_block);  // number of sectors
@@ -104,6 +110,7 @@ void
 ideintr(void)
 {
   struct buf *b;
+  int async;
 
   // First queued buffer is the active request.
   acquire(&idelock);
@@ -119,8 +126,9 @@ ideintr(void)
     insl(0x1f0, b->data, BSIZE/4);
 
   // Wake process waiting for this buf.
+  async = b->flags & B_ASYNC;
   b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
+  b->flags &= ~(B_DIRTY|B_ASYNC);
   wakeup(b);
 
   // Start disk on next buf in queue.
@@ -128,12 +136,18 @@ ideintr(void)
     idestart(idequeue);
 
   release(&idelock);
+
+  // Nobody waits for a read-ahead; release its buffer.
+  if(async)
+    basyncdone(b);
 }
 
 //PAGEBREAK!
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, only queue the request; ideintr() releases
+// the buffer when it is done.
 void
 iderw(struct buf *b)
 {
@@ -159,7 +173,7 @@ iderw(struct buf *b)
     idestart(b);
 
   // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+  while(!(b->flags & B_ASYNC) && (b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
 
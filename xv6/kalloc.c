@@ -1,6 +1,32 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and slab caches. Allocates 4096-byte pages.
+//
+// Free memory is managed by a buddy allocator. A free block
+// is 2^order physically contiguous pages, aligned to its own
+// size, for order 0 to MAXORDER; there is one free list per
+// order. kallocpages() splits a larger block when its own list
+// is empty, and kfree() merges a freed block with its buddy
+// (the block it was split from) for as long as the buddy is
+// free too. kalloc() is kallocpages(0).
+//
+// Every page has a reference count so that copy-on-write
+// fork and shared memory can map one physical page into
+// several address spaces. kalloc() returns a page with
+// count 1, kdup() adds a reference, and kfree() drops one,
+// returning the block to the free lists when none are left.
+// Only the first page of a multi-page block is counted.
+//
+// zerolist holds single pages that an idle CPU has taken
+// from the free lists and cleared (see kzeroidle), so kzalloc()
+// can return zeroed memory without touching it on the caller's
+// path. Building with KPOISON=1 fills freed pages with junk to
+// catch dangling references.
+//
+// The amount of RAM is read from the BIOS at boot. Memory
+// above PHYSLIMIT cannot be direct-mapped below DEVSPACE and
+// is left unused. The per-page state is an array placed
+// just past the kernel's end, sized to the RAM found.
 
 #include "types.h"
 #include "defs.h"
@@ -8,21 +34,41 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "memstat.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+uint phystop;  // top of usable physical memory
+
 struct run {
   struct run *next;
+  struct run *prev;  // free lists only
+};
+
+// State of one physical page.
+struct page {
+  ushort ref;    // references to the block this page starts
+  uchar order;   // size of the block this page starts
+  uchar free;    // starts a block on a free list
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run free[MAXORDER+1];  // free blocks of each order
+  int npages;             // pages given to the allocator
+  int nfree;              // pages on the free lists
+  struct run *zerolist;   // free pages known to be zero
+  int nzero;              // length of zerolist
+  int ncommit;            // pages promised by sbrk(), not yet touched
+  struct page *pages;     // per physical page, protected by lock
 } kmem;
 
+#define PG(v) (&kmem.pages[V2P(v)/PGSIZE])
+#define BLKSIZE(order) (PGSIZE << (order))
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,8 +77,29 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  uint mem, n;
+  int i;
+
   initlock(&kmem.lock, "kmem");
   kmem.use_lock = 0;
+  for(i = 0; i <= MAXORDER; i++)
+    kmem.free[i].next = kmem.free[i].prev = &kmem.free[i];
+
+  mem = cmosmemsize();
+  phystop = PGROUNDDOWN(mem);
+  if(phystop > PHYSLIMIT){
+    cprintf("kinit1: using %dMB of %dMB\n", PHYSLIMIT >> 20, mem >> 20);
+    phystop = PHYSLIMIT;
+  }
+  if(phystop < V2P(vend))
+    panic("kinit1: too little memory");
+
+  n = phystop/PGSIZE * sizeof(kmem.pages[0]);
+  kmem.pages = (struct page*)vstart;
+  memset(kmem.pages, 0, n);
+  vstart = (char*)vstart + n;
+  if(vstart >= vend)
+    panic("kinit1: pages");
   freerange(vstart, vend);
 }
 
@@ -43,37 +110,211 @@ kinit2(void *vstart, void *vend)
   kmem.use_lock = 1;
 }
 
+static void
+listadd(struct run *head, struct run *r)
+{
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+static void
+listdel(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
+// Put the block of 2^order pages at v on the free lists,
+// merging it with its buddy while the buddy is free.
+// Caller holds kmem.lock.
+static void
+buddyfree(char *v, int order)
+{
+  struct page *b;
+  uint pa, bpa;
+
+  kmem.nfree += 1 << order;
+  pa = V2P(v);
+  for(; order < MAXORDER; order++){
+    bpa = pa ^ BLKSIZE(order);
+    if(bpa >= phystop)
+      break;
+    b = &kmem.pages[bpa/PGSIZE];
+    if(!b->free || b->order != order)
+      break;
+    listdel((struct run*)P2V(bpa));
+    b->free = 0;
+    pa &= ~BLKSIZE(order);
+  }
+  v = P2V(pa);
+  PG(v)->order = order;
+  PG(v)->free = 1;
+  listadd(&kmem.free[order], (struct run*)v);
+}
+
+// Take a block of 2^order pages off the free lists, splitting
+// a larger block if necessary. Returns 0 if none is free.
+// Caller holds kmem.lock.
+static char*
+buddyalloc(int order)
+{
+  struct run *r;
+  char *b;
+  int o;
+
+  for(o = order; o <= MAXORDER; o++)
+    if(kmem.free[o].next != &kmem.free[o])
+      break;
+  if(o > MAXORDER)
+    return 0;
+  r = kmem.free[o].next;
+  listdel(r);
+  PG(r)->free = 0;
+  while(o > order){
+    o--;
+    b = (char*)r + BLKSIZE(o);  // upper half goes back
+    PG(b)->order = o;
+    PG(b)->free = 1;
+    listadd(&kmem.free[o], (struct run*)b);
+  }
+  PG(r)->order = order;
+  PG(r)->ref = 1;
+  kmem.nfree -= 1 << order;
+  return (char*)r;
+}
+
+// Free the pages from vstart to vend in the largest aligned
+// blocks that fit, rather than one page at a time.
 void
 freerange(void *vstart, void *vend)
 {
   char *p;
+  int order;
+
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
-    kfree(p);
+  while(p + PGSIZE <= (char*)vend){
+    for(order = MAXORDER; order > 0; order--)
+      if(V2P(p) % BLKSIZE(order) == 0 && p + BLKSIZE(order) <= (char*)vend)
+        break;
+    buddyfree(p, order);
+    kmem.npages += 1 << order;
+    p += BLKSIZE(order);
+  }
 }
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the block of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc() or kallocpages().
+// The block is freed when its last reference is dropped.
 void
 kfree(char *v)
 {
-  struct run *r;
+  int order;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
     panic("kfree");
 
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(PG(v)->ref < 1)
+    panic("kfree: ref");
+  if(--PG(v)->ref > 0){
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  order = PG(v)->order;
+
+#ifdef KPOISON
+  if(kmem.use_lock)
+    release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
-  memset(v, 1, PGSIZE);
+  memset(v, 1, BLKSIZE(order));
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+#endif
+  buddyfree(v, order);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Take a block of 2^order pages for kallocpages(), giving
+// back the zeroed pool if no block is free. Returns 0 if
+// there is still none.
+static char*
+buddytake(int order)
+{
+  struct run *r;
+  char *v;
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  if((v = buddyalloc(order)) == 0 && kmem.zerolist){
+    while((r = kmem.zerolist) != 0){
+      kmem.zerolist = r->next;
+      buddyfree((char*)r, 0);
+    }
+    kmem.nzero = 0;
+    v = buddyalloc(order);
+  }
   if(kmem.use_lock)
     release(&kmem.lock);
+  return v;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their total size. Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+char*
+kallocpages(int order)
+{
+  char *v;
+  int i;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kallocpages");
+
+  // If nothing is free, take pages back from the file page
+  // cache. Another CPU may get to them first, or the pages
+  // freed may not coalesce into a block of this order, so
+  // give up after a few tries.
+  for(i = 0; (v = buddytake(order)) == 0 && i < 4; i++)
+    if(!kmem.use_lock || pcachereclaim(1 << order) == 0)
+      break;
+  return v;
+}
+
+// Whether fewer than 1/frac of all pages are free.
+int
+klowmem(int frac)
+{
+  return kmem.nfree + kmem.nzero < kmem.npages / frac;
+}
+
+// Add n to the count of pages sbrk() has promised but that
+// have not been faulted in yet. A promise fails, returning -1,
+// if the promised pages would no longer fit in free memory
+// plus free swap, less 1/(4*SWAPLOW) of memory kept back for
+// the kernel.
+int
+kcommit(int n)
+{
+  int avail, r;
+
+  avail = swapavail();
+  acquire(&kmem.lock);
+  avail += kmem.nfree + kmem.nzero - kmem.npages/(4*SWAPLOW);
+  r = 0;
+  if(n > 0 && kmem.ncommit + n > avail)
+    r = -1;
+  else
+    kmem.ncommit += n;
+  release(&kmem.lock);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -81,16 +322,106 @@ kfree(char *v)
 // Returns 0 if the memory cannot be allocated.
 char*
 kalloc(void)
+{
+  return kallocpages(0);
+}
+
+// Allocate one zeroed page, preferring the pool of pages
+// cleared in the background.
+// Returns 0 if the memory cannot be allocated.
+char*
+kzalloc(void)
 {
   struct run *r;
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  if((r = kmem.zerolist) != 0){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+    PG(r)->order = 0;
+    PG(r)->ref = 1;
+  }
   if(kmem.use_lock)
     release(&kmem.lock);
+  if(r){
+    r->next = 0;  // the link was the only non-zero word
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
   return (char*)r;
 }
 
+// Called by an idle CPU: move one page from the free lists to
+// the zeroed pool. Returns 0 if there was nothing to do.
+int
+kzeroidle(void)
+{
+  struct run *r;
+
+  if(!kmem.use_lock)
+    return 0;
+  acquire(&kmem.lock);
+  // buddyalloc sets the count to 1, which keeps kdup() and
+  // kfree() off the page while it is cleared.
+  if(kmem.nzero >= NZEROPOOL || (r = (struct run*)buddyalloc(0)) == 0){
+    release(&kmem.lock);
+    return 0;
+  }
+  release(&kmem.lock);
+
+  memset(r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  PG(r)->ref = 0;
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  kmem.nzero++;
+  release(&kmem.lock);
+  return 1;
+}
+
+// Add a reference to page v, which must be allocated.
+// Returns v to enable the v = kdup(v1) idiom.
+char*
+kdup(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
+    panic("kdup");
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(PG(v)->ref < 1)
+    panic("kdup: free page");
+  PG(v)->ref++;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  return v;
+}
+
+// Return the number of references to page v.
+int
+krefcnt(char *v)
+{
+  int n;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  n = PG(v)->ref;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  return n;
+}
+
+
+// Report page allocator counts.
+void
+kmemstat(struct memstat *ms)
+{
+  acquire(&kmem.lock);
+  ms->total = kmem.npages;
+  ms->free = kmem.nfree + kmem.nzero;
+  ms->zeroed = kmem.nzero;
+  release(&kmem.lock);
+}
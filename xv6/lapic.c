@@ -191,6 +191,27 @@ fill_rtcdate(struct rtcdate *r)
   r->year   = cmos_read(YEAR);
 }
 
+#define EXTLO   0x30    // memory from 1MB, in KB (max 64MB)
+#define EXTHI   0x31
+#define EXT16LO 0x34    // memory from 16MB, in 64KB units
+#define EXT16HI 0x35
+
+// Size of the RAM below 4GB, in bytes, as recorded by the BIOS.
+uint
+cmosmemsize(void)
+{
+  uint kb;
+
+  kb = cmos_read(EXT16LO) | (cmos_read(EXT16HI) << 8);
+  if(kb > 0){
+    if(kb > (0xFFFFFFFF - 16*1024*1024) / (64*1024))  // 4GB or more
+      return 0xFFFFFFFF & ~(PGSIZE-1);
+    return 16*1024*1024 + kb*64*1024;
+  }
+  kb = cmos_read(EXTLO) | (cmos_read(EXTHI) << 8);
+  return EXTMEM + kb*1024;
+}
+
 // qemu seems to use 24-hour GWT and the values are BCD encoded
 void
 cmostime(struct rtcdate *r)
@@ -28,6 +28,15 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// Write-back mode (LOGDELAY > 0): the last end_op() does not
+// commit. The transaction stays open, its blocks pinned dirty
+// in the buffer cache, and absorbs later system calls' writes
+// until the flushd kernel thread commits it, LOGDELAY ticks
+// after its first write or sooner when memory is low. It is
+// committed at once when the log is about to run out of space
+// or when sync() asks for it. A crash loses at most the open
+// transaction, and the file system stays consistent.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,6 +51,8 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int syncing;     // processes in logsync(); commit at end_op().
+  uint since;      // ticks when the open transaction first wrote
   int dev;
   struct logheader lh;
 };
@@ -49,6 +60,7 @@ struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void flushd(void);
 
 void
 initlog(int dev)
@@ -63,6 +75,8 @@ initlog(int dev)
   log.size = sb.nlog;
   log.dev = dev;
   recover_from_log();
+  if(LOGDELAY > 0 && kthread("flushd", flushd) == 0)
+    panic("initlog: flushd");
 }
 
 // Copy committed blocks from log to their home location
@@ -140,20 +154,37 @@ begin_op(void)
   }
 }
 
+// Commit the open transaction if no FS system call is in
+// progress. Caller holds log.lock, which is released while
+// committing.
+static void
+trycommit(void)
+{
+  if(log.committing || log.outstanding > 0)
+    return;
+  log.committing = 1;
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  release(&log.lock);
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless write-back mode leaves that to flushd.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 &&
+     (LOGDELAY == 0 || log.syncing || log.lh.n + MAXOPBLOCKS > LOGSIZE)){
+    trycommit();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -161,14 +192,37 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
+
+// Wait until everything written so far is on disk.
+void
+logsync(void)
+{
+  acquire(&log.lock);
+  log.syncing++;
+  while(log.lh.n > 0 || log.committing){
+    if(!log.committing && log.outstanding == 0)
+      trycommit();
+    else
+      sleep(&log, &log.lock);
+  }
+  log.syncing--;
+  release(&log.lock);
+}
+
+// Kernel thread that commits write-back transactions once
+// they are LOGDELAY ticks old, or at once if memory is low.
+static void
+flushd(void)
+{
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    if(log.lh.n > 0 && (ticks - log.since >= LOGDELAY || klowmem(SWAPLOW)))
+      trycommit();
     release(&log.lock);
   }
 }
@@ -226,8 +280,11 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n){
+    if (log.lh.n == 0)
+      log.since = ticks;
     log.lh.n++;
+  }
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
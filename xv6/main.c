@@ -18,6 +18,7 @@ int main(void)
 {
   kinit1(end, P2V(4 * 1024 * 1024));          // phys page allocator
   kvmalloc();                                 // kernel page table
+  slabinit();                                 // kernel object caches
   mpinit();                                   // detect other processors
   lapicinit();                                // interrupt controller
   seginit();                                  // segment descriptors
@@ -30,10 +31,15 @@ int main(void)
   tvinit();                                   // trap vectors
   binit();                                    // buffer cache
   fileinit();                                 // file table
+  icacheinit();                               // inode cache
+  pcacheinit();                               // file page cache
+  dcacheinit();                               // directory entry cache
+  pipeinit();                                 // pipe cache
   ideinit();                                  // disk
   startothers();                              // start other processors
-  kinit2(P2V(4 * 1024 * 1024), P2V(PHYSTOP)); // must come after startothers()
+  kinit2(P2V(4 * 1024 * 1024), P2V(phystop)); // must come after startothers()
   userinit();                                 // first user process
+  swapinit();                                 // paging daemon
   mpmain();                                   // finish this processor's setup
 }
 
@@ -0,0 +1,42 @@
+// Memory usage report filled in by the memstat system call.
+// Sizes are in pages unless noted.
+
+#define MS_NPROC   64   // processes reported (NPROC)
+#define MS_NCACHE  32   // slab caches reported (NSLABCACHE)
+
+struct procmem {
+  int pid;
+  char name[16];
+  uint sz;       // size of address space in bytes
+  uint rss;      // resident user pages
+  uint ptpages;  // page directory and page table pages
+};
+
+struct slabmem {
+  char name[16];
+  uint size;     // object size in bytes
+  int inuse;     // objects allocated
+  int npages;    // slab pages owned
+};
+
+struct memstat {
+  uint total;      // pages managed by the page allocator
+  uint free;       // free pages, including the zeroed pool
+  uint zeroed;     // free pages already cleared
+  uint ptpages;    // page table pages of all processes
+  uint bufs;       // buffers in the buffer cache
+  uint bufpages;   // memory held by the buffer cache
+  uint bhits;      // buffer cache lookups that hit
+  uint bmisses;    // and that missed
+  uint bevicts;    // misses that recycled a buffer
+  uint cachepages; // file pages in the page cache
+  uint slabpages;  // pages owned by slab caches
+  uint pipes;      // open pipes
+  uint shmpages;   // shared memory pages open
+  uint swaptotal;  // pages in the swap area
+  uint swapused;   // swap slots in use
+  int nslab;
+  struct slabmem slab[MS_NCACHE];
+  int nproc;
+  struct procmem proc[MS_NPROC];
+};
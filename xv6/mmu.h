@@ -10,6 +10,7 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
 
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
@@ -94,11 +95,23 @@ struct segdesc {
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_A           0x020   // Accessed
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global, kept in the TLB across cr3 loads
+#define PTE_COW         0x200   // Copy-on-write (software, AVL bit)
+#define PTE_SHARED      0x400   // Shared on fork, never COW (software)
+#define PTE_SWAP        0x800   // Not present, paged out to swap (software)
+
+// Page fault error code bits
+#define FEC_PR          0x1     // Page fault caused by protection violation
+#define FEC_WR          0x2     // Page fault caused by a write
+#define FEC_U           0x4     // Page fault occured while in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
+#define PTE_SLOT(pte)   ((uint)(pte) >> PTXSHIFT)  // swap slot of a PTE_SWAP entry
 
 #ifndef __ASSEMBLER__
 typedef uint pte_t;
@@ -2,13 +2,20 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // cached i-nodes kept even when memory is low
+#define NDENTRY     200  // cached directory entries
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define FSSIZE       4096  // size of file system in blocks
+#define NSLABCACHE   32  // maximum number of slab caches
+#define NVMA          8  // file-backed regions per process
+#define NZEROPOOL   512  // pages kept pre-zeroed by idle CPUs
+#define MAXORDER    10   // largest kallocpages() block is 2^MAXORDER pages
 
+#define LOGDELAY    100  // ticks a transaction may stay uncommitted; 0 commits at end_op
+#define SWAPSIZE   1024  // pages in the swap area after the file system
+#define SWAPLOW      16  // swapd pages out below 1/SWAPLOW of memory free
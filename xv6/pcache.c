@@ -0,0 +1,459 @@
+// Page cache for the contents of regular files.
+//
+// File data is cached in whole pages, found by (dev, inum,
+// page number) in a hash table. readi() copies out of these
+// pages, so a hot file is read from memory, and the blocks
+// are read with breadraw(), so scanning a big file does not
+// push inodes, bitmaps and directories out of the buffer cache,
+// which now holds only metadata and blocks being written.
+// writei() still writes through the log and then updates any
+// cached page; itrunc() drops the file's pages.
+//
+// The cache has no fixed size. It takes new pages from kalloc()
+// while more than 1/PCRESERVE of memory is free and otherwise
+// recycles its least recently used page. When kalloc() runs
+// out of memory it calls pcachereclaim() to get pages back.
+//
+// readi() reads ahead of a sequential reader into pages too,
+// not into the buffer cache. Such a page is hashed at once but
+// stays busy, and pinned, until the disk interrupt has handed
+// each of its blocks to pcacheiodone(); anyone looking it up
+// waits.
+//
+// mmap(MAP_SHARED) maps the cached pages themselves, each with
+// a page reference of its own (see kdup). A page with such
+// references is not reclaimed or recycled, so the mapping and
+// read() and write() keep seeing the same bytes.
+//
+// Callers hold the inode's sleep-lock, so only one process at
+// a time fills or changes the pages of a file. A page being
+// copied is pinned (ref > 0) so that reclaim leaves it alone.
+// pcache.lock may be held while calling kfree(), but never
+// kalloc(), which can call back into pcachereclaim().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "file.h"
+#include "slab.h"
+#include "memstat.h"
+
+#define NPCHASH   127  // hash buckets
+#define PCRESERVE 8    // leave 1/PCRESERVE of memory free
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct cpage {
+  struct buf io[PGSIZE/BSIZE]; // for read-ahead, one per block
+  int busy;            // read-ahead blocks not yet read
+  uint dev;
+  uint inum;
+  uint pgno;           // file offset / PGSIZE
+  int ref;             // pinned while > 0
+  char *data;          // one page
+  struct cpage *hnext; // hash chain
+  struct cpage *prev;  // LRU list, most recent first
+  struct cpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage *hash[NPCHASH];
+  struct cpage lru;        // head of LRU list
+  struct cpage *spare;     // unused entries, through hnext
+  int npages;
+  struct kmem_cache *cache;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.lru.next = pcache.lru.prev = &pcache.lru;
+  if((pcache.cache = kmem_cache_create("cpage", sizeof(struct cpage))) == 0)
+    panic("pcacheinit");
+}
+
+static uint
+pchash(uint dev, uint inum, uint pgno)
+{
+  return (dev * 31 + inum * 131 + pgno) % NPCHASH;
+}
+
+static void
+lrudel(struct cpage *cp)
+{
+  cp->prev->next = cp->next;
+  cp->next->prev = cp->prev;
+}
+
+static void
+lrufront(struct cpage *cp)
+{
+  cp->next = pcache.lru.next;
+  cp->prev = &pcache.lru;
+  pcache.lru.next->prev = cp;
+  pcache.lru.next = cp;
+}
+
+// Remove cp from the hash table and LRU list.
+// Caller holds pcache.lock.
+static void
+pcunlink(struct cpage *cp)
+{
+  struct cpage **pp;
+
+  for(pp = &pcache.hash[pchash(cp->dev, cp->inum, cp->pgno)]; *pp != cp;
+      pp = &(*pp)->hnext)
+    ;
+  *pp = cp->hnext;
+  lrudel(cp);
+}
+
+// Find a cached page and pin it, waiting for any read-ahead
+// of it to finish. Caller holds pcache.lock.
+static struct cpage*
+pclookup(uint dev, uint inum, uint pgno)
+{
+  struct cpage *cp;
+
+  for(cp = pcache.hash[pchash(dev, inum, pgno)]; cp; cp = cp->hnext){
+    if(cp->dev == dev && cp->inum == inum && cp->pgno == pgno){
+      cp->ref++;
+      lrudel(cp);
+      lrufront(cp);
+      while(cp->busy)
+        sleep(cp, &pcache.lock);
+      return cp;
+    }
+  }
+  return 0;
+}
+
+// Make cp page pgno of ip, pinned, and hash it.
+// Caller holds pcache.lock.
+static void
+pcenter(struct cpage *cp, struct inode *ip, uint pgno)
+{
+  uint h;
+
+  cp->dev = ip->dev;
+  cp->inum = ip->inum;
+  cp->pgno = pgno;
+  cp->ref = 1;
+  h = pchash(cp->dev, cp->inum, pgno);
+  cp->hnext = pcache.hash[h];
+  pcache.hash[h] = cp;
+  lrufront(cp);
+}
+
+// Whether a process has cp's page mapped (see pcachemap).
+static int
+pcmapped(struct cpage *cp)
+{
+  return krefcnt(cp->data) > 1;
+}
+
+// Get a page for the cache, in no list. Returns 0 if there
+// is none to be had.
+static struct cpage*
+pcalloc(void)
+{
+  struct cpage *cp;
+  char *data;
+  int k;
+
+  // Use a new page while memory is plentiful.
+  cp = 0;
+  if(!klowmem(PCRESERVE) && (data = kalloc()) != 0){
+    acquire(&pcache.lock);
+    if((cp = pcache.spare) != 0)
+      pcache.spare = cp->hnext;
+    release(&pcache.lock);
+    if(cp == 0 && (cp = kmem_cache_alloc(pcache.cache)) != 0){
+      for(k = 0; k < PGSIZE/BSIZE; k++)
+        initsleeplock(&cp->io[k].lock, "cpage");
+      cp->busy = 0;
+    }
+    if(cp == 0)
+      kfree(data);
+    if(cp){
+      cp->data = data;
+      acquire(&pcache.lock);
+      pcache.npages++;
+      release(&pcache.lock);
+    }
+  }
+
+  // Otherwise recycle the least recently used page.
+  if(cp == 0){
+    acquire(&pcache.lock);
+    for(cp = pcache.lru.prev; cp != &pcache.lru; cp = cp->prev)
+      if(cp->ref == 0 && !pcmapped(cp))
+        break;
+    if(cp == &pcache.lru){
+      release(&pcache.lock);
+      return 0;
+    }
+    pcunlink(cp);
+    release(&pcache.lock);
+  }
+  return cp;
+}
+
+
+// Return page pgno of ip, reading it in if it is not cached.
+// The page is pinned. Returns 0 if no page could be found
+// to hold it. Caller holds ip->lock.
+static struct cpage*
+pcget(struct inode *ip, uint pgno)
+{
+  struct cpage *cp;
+  uint k, off;
+
+  acquire(&pcache.lock);
+  if((cp = pclookup(ip->dev, ip->inum, pgno)) != 0){
+    release(&pcache.lock);
+    return cp;
+  }
+  release(&pcache.lock);
+
+  if((cp = pcalloc()) == 0)
+    return 0;
+
+  // cp is in no list, so nobody else can see it yet.
+  for(k = 0; k < PGSIZE; k += BSIZE){
+    off = pgno*PGSIZE + k;
+    if(off >= ip->size){
+      memset(cp->data + k, 0, PGSIZE - k);
+      break;
+    }
+    breadraw(ip->dev, bmap(ip, off/BSIZE), cp->data + k);
+  }
+  acquire(&pcache.lock);
+  pcenter(cp, ip, pgno);
+  release(&pcache.lock);
+  return cp;
+}
+
+static void
+pcput(struct cpage *cp)
+{
+  acquire(&pcache.lock);
+  cp->ref--;
+  release(&pcache.lock);
+}
+
+// Return an entry whose page has been freed to the spare
+// list. Caller holds pcache.lock.
+static void
+pcspare(struct cpage *cp)
+{
+  cp->hnext = pcache.spare;
+  pcache.spare = cp;
+  pcache.npages--;
+}
+
+// Whether page pgno of ip is cached.
+int
+pcachehas(struct inode *ip, uint pgno)
+{
+  struct cpage *cp;
+
+  acquire(&pcache.lock);
+  for(cp = pcache.hash[pchash(ip->dev, ip->inum, pgno)]; cp; cp = cp->hnext)
+    if(cp->dev == ip->dev && cp->inum == ip->inum && cp->pgno == pgno)
+      break;
+  release(&pcache.lock);
+  return cp != 0;
+}
+
+// Start reading page pgno of ip into the cache, unless it is
+// cached already, without waiting for the disk. Blocks that the
+// buffer cache holds are copied from there, since its copy may
+// be newer than the disk's. Caller holds ip->lock.
+void
+pcachereadahead(struct inode *ip, uint pgno)
+{
+  struct cpage *cp;
+  struct buf *b;
+  uint addr[PGSIZE/BSIZE], k, off, n;
+
+  if(pcachehas(ip, pgno) || (cp = pcalloc()) == 0)
+    return;
+
+  n = 0;
+  for(k = 0; k < PGSIZE/BSIZE; k++){
+    addr[k] = 0;
+    off = pgno*PGSIZE + k*BSIZE;
+    if(off >= ip->size)
+      memset(cp->data + k*BSIZE, 0, BSIZE);
+    else if(bcached(ip->dev, addr[k] = bmap(ip, off/BSIZE))){
+      breadraw(ip->dev, addr[k], cp->data + k*BSIZE);
+      addr[k] = 0;
+    } else
+      n++;
+  }
+
+  acquire(&pcache.lock);
+  pcenter(cp, ip, pgno);
+  cp->busy = n;
+  if(n == 0)
+    cp->ref--;
+  release(&pcache.lock);
+
+  for(k = 0; k < PGSIZE/BSIZE; k++){
+    if(addr[k] == 0)
+      continue;
+    b = &cp->io[k];
+    acquiresleep(&b->lock);
+    b->dev = ip->dev;
+    b->blockno = addr[k];
+    b->data = (uchar*)cp->data + k*BSIZE;
+    b->page = cp;
+    b->flags = B_ASYNC | B_PAGE;
+    iderw(b);
+  }
+}
+
+// The disk has read a block started by pcachereadahead().
+// Called from the disk interrupt.
+void
+pcacheiodone(struct buf *b)
+{
+  struct cpage *cp;
+
+  cp = b->page;
+  releasesleep(&b->lock);
+  acquire(&pcache.lock);
+  if(--cp->busy == 0){
+    cp->ref--;
+    wakeup(cp);
+  }
+  release(&pcache.lock);
+}
+
+// Read n bytes at off from regular file ip through the cache.
+// The range must lie within the file. Returns the number of
+// bytes read, which is less than n if the cache had no room;
+// the caller reads the rest through the buffer cache.
+// Caller holds ip->lock.
+int
+pcacheread(struct inode *ip, char *dst, uint off, uint n)
+{
+  struct cpage *cp;
+  uint tot, m;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if((cp = pcget(ip, off/PGSIZE)) == 0)
+      break;
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    memmove(dst, cp->data + off%PGSIZE, m);
+    pcput(cp);
+  }
+  return tot;
+}
+
+// Return page pgno of ip for mapping into a process, with a
+// page reference the caller must kfree(). Returns 0 if no page
+// could be found to hold it. Caller holds ip->lock.
+char*
+pcachemap(struct inode *ip, uint pgno)
+{
+  struct cpage *cp;
+  char *data;
+
+  if((cp = pcget(ip, pgno)) == 0)
+    return 0;
+  acquire(&pcache.lock);
+  data = kdup(cp->data);
+  cp->ref--;
+  release(&pcache.lock);
+  return data;
+}
+
+// Bring cached pages of ip up to date after writei() wrote
+// n bytes from src at off. Caller holds ip->lock.
+void
+pcachewrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct cpage *cp;
+  uint tot, m;
+
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    acquire(&pcache.lock);
+    cp = pclookup(ip->dev, ip->inum, off/PGSIZE);
+    release(&pcache.lock);
+    if(cp){
+      memmove(cp->data + off%PGSIZE, src, m);
+      pcput(cp);
+    }
+  }
+}
+
+// Free every cached page of ip, whose contents are going
+// away. Caller holds ip->lock, so none of them is pinned
+// except by a read-ahead, which is waited for. A page that is
+// still mapped is left to its mappings.
+void
+pcachedrop(struct inode *ip)
+{
+  struct cpage *cp, *next;
+  int i;
+
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCHASH; i++){
+    for(cp = pcache.hash[i]; cp; cp = next){
+      next = cp->hnext;
+      if(cp->dev != ip->dev || cp->inum != ip->inum)
+        continue;
+      if(cp->busy){
+        sleep(cp, &pcache.lock);
+        next = pcache.hash[i];  // the chain may have changed
+        continue;
+      }
+      pcunlink(cp);
+      kfree(cp->data);
+      pcspare(cp);
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Give up to n unpinned pages back to kalloc(), least
+// recently used first. Returns the number freed. Entries
+// are kept on the spare list rather than freed to the slab,
+// whose allocation may be the one that ran out of memory.
+int
+pcachereclaim(int n)
+{
+  struct cpage *cp, *prev;
+  int got;
+
+  got = 0;
+  acquire(&pcache.lock);
+  for(cp = pcache.lru.prev; cp != &pcache.lru && got < n; cp = prev){
+    prev = cp->prev;
+    if(cp->ref > 0 || pcmapped(cp))
+      continue;
+    pcunlink(cp);
+    kfree(cp->data);
+    pcspare(cp);
+    got++;
+  }
+  release(&pcache.lock);
+  return got;
+}
+
+void
+pcachestat(struct memstat *ms)
+{
+  acquire(&pcache.lock);
+  ms->cachepages = pcache.npages;
+  release(&pcache.lock);
+}
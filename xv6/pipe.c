@@ -8,28 +8,50 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#define PIPEORDER 2  // buffer is 2^PIPEORDER contiguous pages
+#define PIPESIZE  (PGSIZE << PIPEORDER)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // PIPESIZE bytes from kallocpages()
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static struct kmem_cache *pipecache;
+
+void
+pipeinit(void)
+{
+  if((pipecache = kmem_cache_create("pipe", sizeof(struct pipe))) == 0)
+    panic("pipeinit");
+}
+
+// Number of pipes open.
+int
+pipecount(void)
+{
+  return kmem_cache_inuse(pipecache);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
+  char *data;
 
   p = 0;
+  data = 0;
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((data = kallocpages(PIPEORDER)) == 0)
+    goto bad;
+  if((p = kmem_cache_alloc(pipecache)) == 0)
     goto bad;
+  p->data = data;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -48,7 +70,9 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    kmem_cache_free(pipecache, p);
+  if(data)
+    kfree(data);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,7 +93,8 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    kfree(p->data);
+    kmem_cache_free(pipecache, p);
   } else
     release(&p->lock);
 }
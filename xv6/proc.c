@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "memstat.h"
 
 struct {
   struct spinlock lock;
@@ -88,6 +89,9 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->pgfaults = 0;
+  p->lastcpu = 0;
+  p->swappable = 0;
 
   release(&ptable.lock);
 
@@ -153,21 +157,93 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Start a kernel thread running fn, which must never return.
+// Its page table maps only the kernel.
+struct proc*
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    return 0;
+  if((p->pgdir = setupkvm()) == 0){
+    kfree(p->kstack);
+    p->kstack = 0;
+    p->state = UNUSED;
+    return 0;
+  }
+  // forkret() returns to fn instead of trapret.
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+  return p;
+}
+
+// Where swappick() left off.
+static struct {
+  int proc;  // index in ptable.proc
+  uint va;
+} hand;
+
+// Find a user page for swapd to page out to slot, going on
+// with the clock scan over all processes from where the last
+// call stopped. Only processes marked swappable are scanned,
+// so no process is using the page tables being changed.
+// Returns the page, or 0 if two passes found none.
+char*
+swappick(uint slot)
+{
+  struct proc *p;
+  char *mem;
+  int n;
+
+  acquire(&ptable.lock);
+  for(n = 0; n <= 2*NPROC; n++){
+    p = &ptable.proc[hand.proc];
+    if(p->swappable && (p->state == RUNNABLE || p->state == SLEEPING) &&
+       (mem = uvmevict(p, &hand.va, slot)) != 0){
+      release(&ptable.lock);
+      return mem;
+    }
+    hand.proc = (hand.proc + 1) % NPROC;
+    hand.va = 0;
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint sz, npg;
   struct proc *curproc = myproc();
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the address space; pagefault() allocates
+    // and zeroes each page when it is first touched. The pages
+    // still count against memory plus swap, so that running
+    // out fails here rather than in a later page fault.
+    if(sz + n < sz || sz + n >= MMAPBASE)
       return -1;
+    npg = (PGROUNDUP(sz + n) - PGROUNDUP(sz)) / PGSIZE;
+    if(kcommit(npg) < 0)
+      return -1;
+    curproc->ncommit += npg;
+    sz += n;
   } else if(n < 0){
+    npg = uvmuntouched(curproc->pgdir, sz + n, sz);
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
+    if(npg > curproc->ncommit)
+      npg = curproc->ncommit;
+    kcommit(-npg);
+    curproc->ncommit -= npg;
   }
   curproc->sz = sz;
   switchuvm(curproc);
@@ -197,6 +273,19 @@ fork(void)
     return -1;
   }
   np->sz = curproc->sz;
+  // The child may touch the pages the parent has not.
+  if(vmadup(np, curproc) < 0 || kcommit(curproc->ncommit) < 0){
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    begin_op();
+    vmafree(np->vma);
+    end_op();
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->ncommit = curproc->ncommit;
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
@@ -221,6 +310,64 @@ fork(void)
   return pid;
 }
 
+// Create a new process running the program at path with
+// arguments argv. Unlike fork followed by exec, the caller's
+// address space is never copied. The child's descriptor i is
+// a duplicate of the caller's descriptor fdmap[i], or closed
+// if fdmap[i] is -1; if fdmap is 0 the child inherits them all.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, int *fdmap)
+{
+  int i, fd, pid;
+  uint entry, sp;
+  char *s, *last;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if(fdmap)
+    for(i = 0; i < NOFILE; i++)
+      if(fdmap[i] < -1 || fdmap[i] >= NOFILE ||
+         (fdmap[i] >= 0 && curproc->ofile[fdmap[i]] == 0))
+        return -1;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  if(loadprog(path, argv, &np->pgdir, &np->sz, &entry, &sp, np->vma) < 0){
+    np->pgdir = 0;
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->parent = curproc;
+  *np->tf = *curproc->tf;
+  np->tf->eip = entry;  // main
+  np->tf->esp = sp;
+
+  for(i = 0; i < NOFILE; i++){
+    fd = fdmap ? fdmap[i] : i;
+    if(fd >= 0 && curproc->ofile[fd])
+      np->ofile[i] = filedup(curproc->ofile[fd]);
+  }
+  np->cwd = idup(curproc->cwd);
+
+  for(last=s=path; *s; s++)
+    if(*s == '/')
+      last = s+1;
+  safestrcpy(np->name, last, sizeof(np->name));
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  np->state = RUNNABLE;
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -242,10 +389,14 @@ exit(void)
     }
   }
 
+  vmasync(curproc);
   begin_op();
   iput(curproc->cwd);
+  vmafree(curproc->vma);
   end_op();
   curproc->cwd = 0;
+  kcommit(-curproc->ncommit);
+  curproc->ncommit = 0;
 
   acquire(&ptable.lock);
 
@@ -307,7 +458,9 @@ wait(void)
     }
 
     // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+    curproc->swappable = 1;
     sleep(curproc, &ptable.lock);  //DOC: wait-sleep
+    curproc->swappable = 0;
   }
 }
 
@@ -324,6 +477,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
   
   for(;;){
@@ -331,20 +485,23 @@ scheduler(void)
     sti();
 
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
       if(p->state != RUNNABLE)
         continue;
+      ran = 1;
 
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
       c->proc = p;
-      switchuvm(p);
+      resumeuvm(p);
       p->state = RUNNING;
 
+      // p's page directory stays loaded after swtch returns;
+      // only kernel mappings are used until the next switch.
       swtch(&(c->scheduler), p->context);
-      switchkvm();
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
@@ -352,6 +509,13 @@ scheduler(void)
     }
     release(&ptable.lock);
 
+    // Nothing to run: spend the idle time zeroing free pages,
+    // and let go of an exited process's page directory.
+    if(!ran){
+      if(c->deadpgdir)
+        switchkvm();
+      kzeroidle();
+    }
   }
 }
 
@@ -405,8 +569,10 @@ forkret(void)
     // of a regular process (e.g., they call sleep), and thus cannot
     // be run from main().
     first = 0;
-    iinit(ROOTDEV);
+    // Recover the log first: iinit() counts the free
+    // blocks in the bitmap.
     initlog(ROOTDEV);
+    iinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -496,6 +662,48 @@ kill(int pid)
   return -1;
 }
 
+// Give p the address space pgdir of sz bytes, returning its
+// old page directory for the caller to free. procmemstat()
+// walks other processes' page tables holding ptable.lock, so
+// once this returns nobody can be looking at the old one.
+pde_t*
+replaceuvm(struct proc *p, pde_t *pgdir, uint sz)
+{
+  pde_t *old;
+
+  acquire(&ptable.lock);
+  old = p->pgdir;
+  p->pgdir = pgdir;
+  p->sz = sz;
+  release(&ptable.lock);
+  return old;
+}
+
+// Report the memory used by each process.
+void
+procmemstat(struct memstat *ms)
+{
+  struct procmem *pm;
+  struct proc *p;
+
+  ms->nproc = 0;
+  ms->ptpages = 0;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED || p->state == EMBRYO || p->pgdir == 0)
+      continue;
+    if(ms->nproc >= MS_NPROC)
+      break;
+    pm = &ms->proc[ms->nproc++];
+    pm->pid = p->pid;
+    safestrcpy(pm->name, p->name, sizeof(pm->name));
+    pm->sz = p->sz;
+    pm->rss = uvmrss(p->pgdir, &pm->ptpages);
+    ms->ptpages += pm->ptpages;
+  }
+  release(&ptable.lock);
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -523,7 +731,8 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s sz %d faults %d", p->pid, state, p->name,
+            p->sz, p->pgfaults);
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
@@ -531,4 +740,7 @@ procdump(void)
     }
     cprintf("\n");
   }
+  for(i = 0; i < ncpu; i++)
+    cprintf("cpu%d: cr3 loads %d skipped %d\n", i,
+            cpus[i].cr3loads, cpus[i].cr3skips);
 }
\ No newline at end of file
@@ -10,6 +10,10 @@ struct cpu
   int intena;                // Were interrupts enabled before pushcli?
   struct proc *proc;         // The process running on this cpu or null
   int num_sys_calls;         // Counts number of syste call in this cpu
+  pde_t *curpgdir;           // Page directory loaded in cr3
+  pde_t *deadpgdir;          // Freed while loaded here; free at next switch
+  uint cr3loads;             // Address space switches that reloaded cr3
+  uint cr3skips;             // Switches that kept the loaded cr3
 };
 
 extern struct cpu cpus[NCPU];
@@ -35,6 +39,20 @@ struct context
   uint eip;
 };
 
+// A region of user memory backed by a file. Pages are read
+// from the inode the first time they are touched; in private
+// regions bytes past filesz are zero. Program segments lie
+// inside sz; regions made by mmap() lie above MMAPBASE.
+struct vma {
+  uint start;          // first address, page aligned; 0 if unused
+  uint end;            // one past the last address
+  struct inode *ip;    // backing file (holds a reference)
+  uint off;            // file offset of start
+  uint filesz;         // bytes of file data from start
+  int prot;            // PROT_READ, PROT_WRITE
+  int flags;           // MAP_SHARED or MAP_PRIVATE
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -52,6 +70,12 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  uint pgfaults;               // Page faults resolved
+  uint ncommit;                // Pages sbrk() reserved, not yet touched
+  struct cpu *lastcpu;         // CPU this process last ran on
+  int swappable;               // Won't touch user memory before it next
+                               // runs in user space; swapd may page it out
+  struct vma vma[NVMA];        // File-backed regions (program segments)
 };
 
 // Process memory is laid out contiguously, low addresses first:
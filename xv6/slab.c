@@ -0,0 +1,298 @@
+// Slab allocator for small kernel objects.
+//
+// kalloc() hands out whole 4096-byte pages, which wastes most of
+// a page on objects like priority-lock queue nodes, pipes and
+// open files. A kmem_cache carves pages ("slabs") into equal-sized
+// objects. Each slab page starts with a struct slab header, so
+// the cache owning an object is found by rounding the object's
+// address down to its page.
+//
+// Every cache keeps a short per-CPU list of free objects, so the
+// common alloc/free path only disables interrupts and never
+// touches the cache lock. The per-CPU lists are refilled from,
+// and drained back to, the slabs in batches of SLAB_BATCH.
+//
+// kmalloc()/kmfree() are a general allocator on top of a set of
+// power-of-two caches from 16 to KMALLOC_MAX bytes. Larger
+// requests should use kalloc() directly.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "memstat.h"
+
+#define SLAB_BATCH   8    // objects moved between a CPU list and slabs
+#define SLAB_CPUMAX  (2*SLAB_BATCH)  // drain a CPU list above this
+
+struct obj {
+  struct obj *next;
+};
+
+// Header at the start of every slab page.
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;   // partial or full list of the cache
+  struct obj *free;    // free objects in this slab
+  int inuse;           // allocated objects, including CPU lists
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NSLABCACHE];
+} slabtable;
+
+static struct kmem_cache *kmalloc_caches[KMALLOC_NCLASS];
+
+static char *kmalloc_names[KMALLOC_NCLASS] = {
+  "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+  "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+void
+slabinit(void)
+{
+  int i;
+
+  initlock(&slabtable.lock, "slabtable");
+  for(i = 0; i < KMALLOC_NCLASS; i++){
+    kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], 16 << i);
+    if(kmalloc_caches[i] == 0)
+      panic("slabinit");
+  }
+}
+
+// Create a cache of objects of the given size.
+// Returns 0 if the size is too big or the table is full.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(struct obj))
+    size = sizeof(struct obj);
+  if(size > PGSIZE - sizeof(struct slab))
+    return 0;
+
+  acquire(&slabtable.lock);
+  for(c = slabtable.cache; c < &slabtable.cache[NSLABCACHE]; c++)
+    if(c->size == 0)
+      goto found;
+  release(&slabtable.lock);
+  return 0;
+
+found:
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / size;
+  initlock(&c->lock, name);
+  release(&slabtable.lock);
+  return c;
+}
+
+// Carve a fresh page into objects. Caller holds c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  struct obj *o;
+  char *p;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  p = (char*)(s + 1);
+  for(i = 0; i < c->perslab; i++, p += c->size){
+    o = (struct obj*)p;
+    o->next = s->free;
+    s->free = o;
+  }
+  s->next = c->partial;
+  c->partial = s;
+  c->npages++;
+  return s;
+}
+
+// Move a slab from list *from to list *to.
+static void
+slab_move(struct slab **from, struct slab **to, struct slab *s)
+{
+  struct slab **pp;
+
+  for(pp = from; *pp; pp = &(*pp)->next){
+    if(*pp == s){
+      *pp = s->next;
+      s->next = *to;
+      *to = s;
+      return;
+    }
+  }
+  panic("slab_move");
+}
+
+// Take up to n objects from the slabs and chain them on *list.
+// Caller holds c->lock. Returns the number taken.
+static int
+slab_take(struct kmem_cache *c, struct obj **list, int n)
+{
+  struct slab *s;
+  struct obj *o;
+  int got;
+
+  for(got = 0; got < n; got++){
+    if((s = c->partial) == 0 && (s = slab_grow(c)) == 0)
+      break;
+    o = s->free;
+    s->free = o->next;
+    s->inuse++;
+    if(s->free == 0)
+      slab_move(&c->partial, &c->full, s);
+    o->next = *list;
+    *list = o;
+  }
+  return got;
+}
+
+// Return object o to its slab. Caller holds c->lock.
+// A slab with no objects left in use goes back to kalloc.
+static void
+slab_put(struct kmem_cache *c, struct obj *o)
+{
+  struct slab *s, **pp;
+
+  s = (struct slab*)PGROUNDDOWN((uint)o);
+  if(s->cache != c)
+    panic("slab_put");
+  if(s->free == 0)
+    slab_move(&c->full, &c->partial, s);
+  o->next = s->free;
+  s->free = o;
+  if(--s->inuse > 0)
+    return;
+  for(pp = &c->partial; *pp != s; pp = &(*pp)->next)
+    ;
+  *pp = s->next;
+  c->npages--;
+  kfree((char*)s);
+}
+
+// Allocate one object from cache c.
+// Returns 0 if no memory is available.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct kmem_cpu *kc;
+  struct obj *o;
+
+  pushcli();
+  kc = &c->cpu[cpuid()];
+  if(kc->free == 0){
+    acquire(&c->lock);
+    kc->n += slab_take(c, &kc->free, SLAB_BATCH);
+    release(&c->lock);
+  }
+  if((o = kc->free) != 0){
+    kc->free = o->next;
+    kc->n--;
+    kc->inuse++;
+  }
+  popcli();
+  return o;
+}
+
+// Free object v, which must have come from cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *v)
+{
+  struct kmem_cpu *kc;
+  struct obj *o;
+  int i;
+
+  if(((struct slab*)PGROUNDDOWN((uint)v))->cache != c)
+    panic("kmem_cache_free");
+
+  pushcli();
+  kc = &c->cpu[cpuid()];
+  o = (struct obj*)v;
+  o->next = kc->free;
+  kc->free = o;
+  kc->n++;
+  kc->inuse--;
+  if(kc->n > SLAB_CPUMAX){
+    acquire(&c->lock);
+    for(i = 0; i < SLAB_BATCH; i++){
+      o = kc->free;
+      kc->free = o->next;
+      kc->n--;
+      slab_put(c, o);
+    }
+    release(&c->lock);
+  }
+  popcli();
+}
+
+// Allocate n bytes from the smallest power-of-two cache that fits.
+// Returns 0 if n is larger than KMALLOC_MAX or memory is exhausted.
+void*
+kmalloc(uint n)
+{
+  int i;
+
+  for(i = 0; i < KMALLOC_NCLASS; i++)
+    if(n <= (16 << i))
+      return kmem_cache_alloc(kmalloc_caches[i]);
+  return 0;
+}
+
+// Free memory returned by kmalloc().
+void
+kmfree(void *v)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)v);
+  kmem_cache_free(s->cache, v);
+}
+
+// Number of objects allocated from cache c.
+int
+kmem_cache_inuse(struct kmem_cache *c)
+{
+  int i, n;
+
+  n = 0;
+  for(i = 0; i < NCPU; i++)
+    n += c->cpu[i].inuse;
+  return n;
+}
+
+// Report the usage of every cache.
+void
+slabstat(struct memstat *ms)
+{
+  struct kmem_cache *c;
+  struct slabmem *sm;
+
+  ms->nslab = 0;
+  ms->slabpages = 0;
+  acquire(&slabtable.lock);
+  for(c = slabtable.cache; c < &slabtable.cache[NSLABCACHE]; c++){
+    if(c->size == 0 || ms->nslab >= MS_NCACHE)
+      continue;
+    sm = &ms->slab[ms->nslab++];
+    safestrcpy(sm->name, c->name, sizeof(sm->name));
+    sm->size = c->size;
+    sm->inuse = kmem_cache_inuse(c);
+    sm->npages = c->npages;
+    ms->slabpages += c->npages;
+  }
+  release(&slabtable.lock);
+}
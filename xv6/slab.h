@@ -0,0 +1,21 @@
+// Per-CPU list of free objects of one cache.
+struct kmem_cpu {
+  struct obj *free;
+  int n;
+  int inuse;                  // allocs minus frees on this CPU
+};
+
+// A cache of fixed-size kernel objects (see slab.c).
+struct kmem_cache {
+  char *name;
+  uint size;                  // object size, rounded up to 8 bytes
+  int perslab;                // objects per slab page
+  int npages;                 // slab pages owned by this cache
+  struct spinlock lock;       // protects partial, full, npages
+  struct slab *partial;       // slabs with at least one free object
+  struct slab *full;          // slabs with every object allocated
+  struct kmem_cpu cpu[NCPU];
+};
+
+#define KMALLOC_NCLASS 8                            // 16 .. 2048 bytes
+#define KMALLOC_MAX    (16 << (KMALLOC_NCLASS-1))   // largest kmalloc()
@@ -61,7 +61,7 @@ void print_queue2(struct queue *lock)
 
 void add_queue(struct queue **head, int pid)
 {
-  struct queue *res = (struct queue *)kalloc();
+  struct queue *res = (struct queue *)kmalloc(sizeof(struct queue));
   res->pid = pid;
   res->next = 0;
   if (*head == 0)
@@ -100,7 +100,7 @@ void rm_queue(struct queue **head, int pid)
     if (temp->pid == pid)
     {
       *head = temp->next;
-      kfree((char *)temp);
+      kmfree(temp);
     }
     else
     {
@@ -111,7 +111,7 @@ void rm_queue(struct queue **head, int pid)
         {
           struct queue *temp2 = temp->next;
           temp->next = temp->next->next;
-          kfree((char *)temp2);
+          kmfree(temp2);
           return;
         }
       panic("not found in queu!\n");
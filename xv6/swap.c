@@ -0,0 +1,221 @@
+// Paging user memory out to the swap area.
+//
+// mkfs reserves SWAPSIZE pages of disk after the file system.
+// While less than 1/SWAPLOW of memory is free, the swapd kernel
+// thread picks cold user pages with a clock scan (swappick())
+// and writes each to a free swap slot; the page's PTE becomes a
+// PTE_SWAP entry holding the slot number. A fault on the page
+// reads it back (swapfault() in vm.c). fork() shares slots
+// between parent and child, so slots are reference counted.
+//
+// While swapd writes a page out its slot is busy, and
+// swapread() of that slot waits for the write to finish.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "memstat.h"
+
+struct {
+  struct spinlock lock;
+  uint start;            // first block of the swap area
+  uint nslot;            // pages in the swap area
+  uint nfree;            // free slots
+  int busy;              // slot being written by swapd, or -1
+  uchar ref[SWAPSIZE];   // page table entries naming each slot
+  struct buf buf;        // for page transfers, under buf.lock
+} swap;
+
+static void swapd(void);
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.buf.lock, "swapbuf");
+  swap.busy = -1;
+  if(kthread("swapd", swapd) == 0)
+    panic("swapinit");
+}
+
+// Read or write page mem from or to swap slot.
+static void
+swaprw(uint slot, char *mem, int write)
+{
+  struct buf *b;
+  int i;
+
+  b = &swap.buf;
+  acquiresleep(&b->lock);
+  for(i = 0; i < SWAPBPP; i++){
+    b->dev = ROOTDEV;
+    b->blockno = swap.start + slot*SWAPBPP + i;
+    b->data = (uchar*)mem + i*BSIZE;
+    b->flags = write ? B_DIRTY : 0;
+    iderw(b);
+  }
+  releasesleep(&b->lock);
+}
+
+// Allocate a slot for swapd and mark it busy.
+// Returns -1 if the swap area is full.
+static int
+swapalloc(void)
+{
+  uint slot;
+
+  acquire(&swap.lock);
+  for(slot = 0; slot < swap.nslot; slot++){
+    if(swap.ref[slot] == 0){
+      swap.ref[slot] = 1;
+      swap.nfree--;
+      swap.busy = slot;
+      release(&swap.lock);
+      return slot;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Drop a reference to slot.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nfree++;
+  release(&swap.lock);
+}
+
+// Add a reference to slot, for a page table entry copied by fork().
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Read the page in slot into mem. The caller still
+// holds its reference to the slot.
+void
+swapread(uint slot, char *mem)
+{
+  acquire(&swap.lock);
+  while(swap.busy == slot)
+    sleep(&swap, &swap.lock);
+  release(&swap.lock);
+  swaprw(slot, mem, 0);
+}
+
+// Sleep until the next clock tick.
+static void
+swapnap(void)
+{
+  acquire(&tickslock);
+  sleep(&ticks, &tickslock);
+  release(&tickslock);
+}
+
+// Called before a page fault allocates memory. When memory is
+// nearly gone, give swapd a few ticks to page something out
+// rather than fail the allocation. Faults taken while holding
+// a spin-lock cannot sleep and do not wait. Syscalls get
+// here through uvmtouch() with interrupts on, so look at
+// ncli under pushcli(), which itself adds one.
+void
+swapwait(void)
+{
+  int i, locked;
+
+  pushcli();
+  locked = mycpu()->ncli > 1;
+  popcli();
+  if(locked)
+    return;
+  for(i = 0; i < 10 && klowmem(4*SWAPLOW) && !myproc()->killed; i++){
+    acquire(&swap.lock);
+    if(swap.nfree == 0){
+      release(&swap.lock);
+      return;
+    }
+    release(&swap.lock);
+    swapnap();
+  }
+}
+
+static void
+swapd(void)
+{
+  struct superblock sb;
+  char *mem;
+  int slot;
+
+  readsb(ROOTDEV, &sb);
+  acquire(&swap.lock);
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap < SWAPSIZE ? sb.nswap : SWAPSIZE;
+  swap.nfree = swap.nslot;
+  release(&swap.lock);
+  if(swap.nslot > 0)
+    cprintf("swap: %d pages at block %d\n", swap.nslot, swap.start);
+
+  for(;;){
+    while(!klowmem(SWAPLOW))
+      swapnap();
+    // Unused disk buffers are cheaper to give up than user pages.
+    if(bshrink(PGSIZE/BSIZE) > 0 && !klowmem(SWAPLOW))
+      continue;
+    if((slot = swapalloc()) < 0){
+      swapnap();
+      continue;
+    }
+    if((mem = swappick(slot)) == 0){
+      // Nothing to page out right now.
+      swapfree(slot);
+      acquire(&swap.lock);
+      swap.busy = -1;
+      release(&swap.lock);
+      swapnap();
+      continue;
+    }
+    swaprw(slot, mem, 1);
+    acquire(&swap.lock);
+    swap.busy = -1;
+    wakeup(&swap);
+    release(&swap.lock);
+    kfree(mem);
+  }
+}
+
+// Return the number of free swap slots.
+int
+swapavail(void)
+{
+  int n;
+
+  acquire(&swap.lock);
+  n = swap.nfree;
+  release(&swap.lock);
+  return n;
+}
+
+void
+swapstat(struct memstat *ms)
+{
+  acquire(&swap.lock);
+  ms->swaptotal = swap.nslot;
+  ms->swapused = swap.nslot - swap.nfree;
+  release(&swap.lock);
+}
@@ -22,7 +22,9 @@ fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(addr+4 < addr || addr+4 > uvmlimit(curproc, addr))
+    return -1;
+  if(uvmtouch(curproc, addr, 4, 0) < 0)
     return -1;
   *ip = *(int *)(addr);
   return 0;
@@ -37,11 +39,13 @@ fetchstr(uint addr, char **pp)
   char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if((ep = (char*)uvmlimit(curproc, addr)) == 0)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if(s == *pp || (uint)s % PGSIZE == 0)
+      if(uvmtouch(curproc, (uint)s, 1, 0) < 0)
+        return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -56,16 +60,20 @@ int argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
+// lies within the process address space, and if write is set
+// that the kernel may store the system call's result there.
 int
-argptr(int n, char **pp, int size)
+argptr(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (uint)i+size < (uint)i ||
+     (uint)i+size > uvmlimit(curproc, i))
+    return -1;
+  if(uvmtouch(curproc, i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -117,6 +125,12 @@ extern int sys_aq(void);
 extern int sys_print_num_syscalls(void);
 extern int sys_open_sharedmem(void);
 extern int sys_close_sharedmem(void);
+extern int sys_memstat(void);
+extern int sys_spawn(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_sync(void);
+extern int sys_fsync(void);
 
 static int (*syscalls[])(void) = {
     [SYS_fork] sys_fork,
@@ -152,6 +166,12 @@ static int (*syscalls[])(void) = {
     [SYS_print_num_syscalls] sys_print_num_syscalls,
     [SYS_open_sharedmem] sys_open_sharedmem,
     [SYS_close_sharedmem] sys_close_sharedmem,
+    [SYS_memstat] sys_memstat,
+    [SYS_spawn] sys_spawn,
+    [SYS_mmap] sys_mmap,
+    [SYS_munmap] sys_munmap,
+    [SYS_sync] sys_sync,
+    [SYS_fsync] sys_fsync,
 };
 
 void
@@ -32,3 +32,9 @@
 #define SYS_print_num_syscalls 32
 #define SYS_open_sharedmem 33
 #define SYS_close_sharedmem 34
+#define SYS_memstat 35
+#define SYS_spawn 36
+#define SYS_mmap 37
+#define SYS_munmap 38
+#define SYS_sync 39
+#define SYS_fsync 40
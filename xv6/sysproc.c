@@ -71,7 +71,9 @@ sys_sleep(void)
       release(&tickslock);
       return -1;
     }
+    myproc()->swappable = 1;
     sleep(&ticks, &tickslock);
+    myproc()->swappable = 0;
   }
   release(&tickslock);
   return 0;
@@ -7,6 +7,12 @@
 #include "mmu.h"
 #include "proc.h"
 #include "sysutils.h"
+#include "memstat.h"
+
+// User programs see memstat.h but not param.h.
+#if MS_NPROC != NPROC || MS_NCACHE != NSLABCACHE
+#error "memstat.h does not match param.h"
+#endif
 
 struct prioritylock lock;
 struct spinlock lock2;
@@ -67,42 +73,93 @@ int sys_aq(void)
 
 int sys_open_sharedmem(void)
 {
-    acquire(&main_mem.lock);
     int id;
     char **res;
-    if ((argint(0, &id)) < 0 || (argptr(1, (char **)(&res), 4)) < 0)
+    if ((argint(0, &id)) < 0 || (argptr(1, (char **)(&res), 4, 1)) < 0)
+        return -1;
+    if (id < 0 || id >= PAGE_COUNT)
         return -1;
     struct proc *proc = myproc();
     pde_t *pgdir = proc->pgdir;
-    uint va = proc.;
+    // map the shared frame on the page just above the process image
+    uint va = PGROUNDUP(proc->sz);
+    if (va + PGSIZE >= KERNBASE)
+        return -1;
+    acquire(&main_mem.lock);
     if (main_mem.pages[id].ref_count == 0)
     {
-        *res = kalloc();
-        memset(*res, 0, PGSIZE);
-        mappages(pgdir, (char *)va, PGSIZE, V2P(*res), PTE_W | PTE_U);
-        main_mem.pages[id].ref_count++;
-        main_mem.pages[id].frame = (void *)*res;
+        char *frame = kzalloc();
+        if (frame == 0)
+        {
+            release(&main_mem.lock);
+            return -1;
+        }
+        main_mem.pages[id].frame = (void *)frame;
     }
-    else
+    // PTE_SHARED keeps fork from turning the page copy-on-write;
+    // the mapping holds its own page reference, dropped on exit.
+    if (mappages(pgdir, (char *)va, PGSIZE, V2P(main_mem.pages[id].frame), PTE_W | PTE_U | PTE_SHARED) < 0)
     {
-        mappages(pgdir, (char *)va, PGSIZE, V2P(main_mem.pages[id].frame), PTE_W | PTE_U);
-        main_mem.pages[id].ref_count++;
-        *res = (char *)main_mem.pages[id].frame;
+        release(&main_mem.lock);
+        return -1;
     }
+    kdup(main_mem.pages[id].frame);
+    main_mem.pages[id].ref_count++;
     release(&main_mem.lock);
+    proc->sz = va + PGSIZE;
+    *res = (char *)va;
     return 0;
 }
 
 int sys_close_sharedmem(void)
 {
     int id;
-    if ((argint(0, &id)) < 0)
+    if ((argint(0, &id)) < 0 || id < 0 || id >= PAGE_COUNT)
         return -1;
 
+    acquire(&main_mem.lock);
+    if (main_mem.pages[id].ref_count == 0)
+    {
+        release(&main_mem.lock);
+        return -1;
+    }
     main_mem.pages[id].ref_count--;
 
+    // drop the table's reference; mappings keep the frame alive
     if (main_mem.pages[id].ref_count == 0)
+    {
         kfree((char *)main_mem.pages[id].frame);
+        main_mem.pages[id].frame = 0;
+    }
+    release(&main_mem.lock);
 
     return 0;
 }
+
+// Fill in a struct memstat for the caller.
+int sys_memstat(void)
+{
+    struct memstat *ms;
+    char *buf;
+    int i, r;
+
+    if (argptr(0, &buf, sizeof(*ms), 1) < 0)
+        return -1;
+    if (sizeof(*ms) > PGSIZE || (ms = (struct memstat *)kzalloc()) == 0)
+        return -1;
+    kmemstat(ms);
+    slabstat(ms);
+    bstat(ms);
+    pcachestat(ms);
+    swapstat(ms);
+    procmemstat(ms);
+    ms->pipes = pipecount();
+    acquire(&main_mem.lock);
+    for (i = 0; i < PAGE_COUNT; i++)
+        if (main_mem.pages[i].ref_count > 0)
+            ms->shmpages++;
+    release(&main_mem.lock);
+    r = copyout(myproc()->pgdir, (uint)buf, (char *)ms, sizeof(*ms));
+    kfree((char *)ms);
+    return r;
+}
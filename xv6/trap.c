@@ -78,6 +78,14 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // Demand-zero and copy-on-write pages fault in on first
+    // use, from user space or by the kernel on the process's
+    // behalf.
+    if(myproc() && pagefault(myproc(), rcr2(), tf->err) == 0)
+      break;
+    // Otherwise a genuine fault; fall through.
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -102,9 +110,14 @@ trap(struct trapframe *tf)
 
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
+  // Preempted in user space, it won't touch user memory until it
+  // returns there, so swapd may page it out meanwhile.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tf->trapno == T_IRQ0+IRQ_TIMER){
+    myproc()->swappable = (tf->cs&3) == DPL_USER;
     yield();
+    myproc()->swappable = 0;
+  }
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
@@ -2,31 +2,53 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "userlock.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// Small requests, up to SMALLMAX units with the header, are
+// rounded up to a power of two and served from per-class free
+// lists in O(1). Freed small blocks go back on their class list.
+// Empty lists are refilled by carving a BATCH-unit block from
+// the large allocator.
+//
+// Larger requests use the first-fit free list of Kernighan and
+// Ritchie (The C Programming Language, 2nd ed., Section 8.7),
+// which coalesces neighbouring free blocks. Once a free block of
+// at least TRIMMIN units ends at the top of the heap, it is
+// given back to the kernel with sbrk().
+//
+// A user spin-lock protects the allocator, so concurrent
+// callers sharing one heap do not corrupt it.
 
 typedef long Align;
 
 union header {
   struct {
     union header *ptr;
-    uint size;
+    uint size;        // in units of sizeof(Header), with the header
   } s;
   Align x;
 };
 
 typedef union header Header;
 
+#define NCLASS   6                       // classes of 2 .. 64 units
+#define SMALLMAX (2 << (NCLASS-1))       // largest small block
+#define BATCH    512                     // units carved per refill
+#define TRIMMIN  8192                    // units worth trimming
+
 static Header base;
 static Header *freep;
+static Header *small[NCLASS];
+static struct uspinlock lock;
 
-void
-free(void *ap)
+// Free a large block into the sorted list and coalesce it.
+static void
+lfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -43,6 +65,28 @@ free(void *ap)
   freep = p;
 }
 
+// Give a big free block at the top of the heap back to the kernel.
+static void
+trim(void)
+{
+  Header *p, *prevp;
+  char *top;
+
+  top = sbrk(0);
+  for(prevp = freep, p = freep->s.ptr; ; prevp = p, p = p->s.ptr){
+    if((char*)(p + p->s.size) == top){
+      if(p->s.size < TRIMMIN)
+        return;
+      prevp->s.ptr = p->s.ptr;
+      freep = prevp;
+      sbrk(-(int)(p->s.size * sizeof(Header)));
+      return;
+    }
+    if(p == freep)
+      return;
+  }
+}
+
 static Header*
 morecore(uint nu)
 {
@@ -56,17 +100,15 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  lfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static Header*
+lmalloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -81,10 +123,131 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
-      return (void*)(p + 1);
+      return p;
     }
     if(p == freep)
       if((p = morecore(nunits)) == 0)
         return 0;
   }
 }
+
+// Index of the smallest class holding nunits.
+static int
+sclass(uint nunits)
+{
+  int c;
+
+  for(c = 0; (2 << c) < nunits; c++)
+    ;
+  return c;
+}
+
+static Header*
+smalloc(uint nunits)
+{
+  Header *p, *q;
+  int c;
+  uint size;
+
+  c = sclass(nunits);
+  size = 2 << c;
+  if(small[c] == 0){
+    if((q = lmalloc(BATCH)) == 0)
+      return 0;
+    for(p = q; p + size <= q + BATCH; p += size){
+      p->s.size = size;
+      p->s.ptr = small[c];
+      small[c] = p;
+    }
+  }
+  p = small[c];
+  small[c] = p->s.ptr;
+  return p;
+}
+
+static void
+ufree(Header *bp)
+{
+  int c;
+
+  if(bp->s.size <= SMALLMAX){
+    c = sclass(bp->s.size);
+    bp->s.ptr = small[c];
+    small[c] = bp;
+    return;
+  }
+  lfree(bp);
+  trim();
+}
+
+static Header*
+umalloc(uint nbytes)
+{
+  uint nunits;
+
+  if(nbytes > 0x7fffffff)
+    return 0;
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if(nunits <= SMALLMAX)
+    return smalloc(nunits);
+  return lmalloc(nunits);
+}
+
+void
+free(void *ap)
+{
+  if(ap == 0)
+    return;
+  uacquire(&lock);
+  ufree((Header*)ap - 1);
+  urelease(&lock);
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+
+  uacquire(&lock);
+  p = umalloc(nbytes);
+  urelease(&lock);
+  return p ? (void*)(p + 1) : 0;
+}
+
+void*
+calloc(uint n, uint size)
+{
+  void *p;
+
+  if(size && n > 0xffffffff / size)
+    return 0;
+  if((p = malloc(n * size)) != 0)
+    memset(p, 0, n * size);
+  return p;
+}
+
+void*
+realloc(void *ap, uint nbytes)
+{
+  Header *bp, *np;
+  uint have;
+
+  if(ap == 0)
+    return malloc(nbytes);
+  if(nbytes == 0){
+    free(ap);
+    return 0;
+  }
+  bp = (Header*)ap - 1;
+  have = (bp->s.size - 1) * sizeof(Header);
+  if(nbytes <= have)
+    return ap;
+
+  uacquire(&lock);
+  if((np = umalloc(nbytes)) != 0){
+    memmove(np + 1, ap, have);
+    ufree(bp);
+  }
+  urelease(&lock);
+  return np ? (void*)(np + 1) : 0;
+}
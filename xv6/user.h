@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct memstat;
 
 // system calls
 int fork(void);
@@ -34,6 +35,12 @@ int aq(void);
 int print_num_syscalls(void);
 int open_sharedmem(int, char**);
 int close_sharedmem(int);
+int memstat(struct memstat*);
+int spawn(char*, char**, int*);  // fdmap has NOFILE entries
+void* mmap(int, int, int, int, int);
+int munmap(void*, int);
+int sync(void);
+int fsync(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -47,4 +54,6 @@ uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
+void* calloc(uint, uint);
+void* realloc(void*, uint);
 int atoi(const char*);
@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "memstat.h"
 
 char buf[8192];
 char name[3];
@@ -184,6 +185,10 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// Big enough to reach the double-indirect blocks,
+// in 512-byte writes.
+#define BIGFILE ((NDIRECT + NINDIRECT + 8) * (BSIZE / 512))
+
 void
 writetest1(void)
 {
@@ -197,7 +202,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGFILE; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +222,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == BIGFILE - 1){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -300,6 +305,132 @@ exectest(void)
   }
 }
 
+// spawn a program with its stdout mapped to a file, and
+// check that it ran and did not inherit other descriptors.
+void
+spawntest(void)
+{
+  int fd, pid, i, n, fdmap[NOFILE];
+
+  printf(stdout, "spawn test\n");
+  fd = open("spawnout", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "spawn test open failed\n");
+    exit();
+  }
+  for(i = 0; i < NOFILE; i++)
+    fdmap[i] = -1;
+  fdmap[1] = fd;
+  pid = spawn("echo", echoargv, fdmap);
+  if(pid < 0){
+    printf(stdout, "spawn echo failed\n");
+    exit();
+  }
+  if(wait() != pid){
+    printf(stdout, "spawn test wait wrong pid\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("spawnout", O_RDONLY);
+  n = read(fd, buf, sizeof(buf)-1);
+  close(fd);
+  unlink("spawnout");
+  if(n < 0)
+    n = 0;
+  buf[n] = 0;
+  if(strcmp(buf, "ALL TESTS PASSED\n") != 0){
+    printf(stdout, "spawn test wrong output\n");
+    exit();
+  }
+
+  fdmap[1] = NOFILE;
+  if(spawn("echo", echoargv, fdmap) >= 0){
+    printf(stdout, "spawn accepted a bad fdmap\n");
+    exit();
+  }
+  if(spawn("nosuchprogram", echoargv, 0) >= 0){
+    printf(stdout, "spawn of missing program succeeded\n");
+    exit();
+  }
+  printf(stdout, "spawn test OK\n");
+}
+
+// map a file private and shared, and check that shared
+// writes reach the file while private ones do not.
+void
+mmaptest(void)
+{
+  int fd, fd2, i, n;
+  char *p;
+
+  printf(stdout, "mmap test\n");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(stdout, "mmap test create failed\n");
+    exit();
+  }
+
+  p = mmap(fd, 4096, 8192, PROT_READ|PROT_WRITE, MAP_PRIVATE);
+  if(p == (char*)-1){
+    printf(stdout, "mmap private failed\n");
+    exit();
+  }
+  for(i = 0; i < 4096; i++){
+    if(p[i] != buf[4096+i]){
+      printf(stdout, "mmap private read wrong data\n");
+      exit();
+    }
+  }
+  if(p[4096] != 0){
+    printf(stdout, "mmap not zero past end of file\n");
+    exit();
+  }
+  p[0] = 'X';
+  if(munmap(p, 8192) < 0){
+    printf(stdout, "munmap failed\n");
+    exit();
+  }
+
+  p = mmap(fd, 0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED);
+  if(p == (char*)-1){
+    printf(stdout, "mmap shared failed\n");
+    exit();
+  }
+  p[10] = 'Y';
+  // Shared pages are the file's: read() and write() see them.
+  fd2 = open("mmapfile", O_RDWR);
+  if(fd2 < 0 || read(fd2, buf, 11) != 11 || buf[10] != 'Y' ||
+     write(fd2, "Z", 1) != 1 || p[11] != 'Z'){
+    printf(stdout, "mmap shared not coherent with read/write\n");
+    exit();
+  }
+  close(fd2);
+  if(munmap(p, 4096) < 0 || munmap(p, 4096) == 0){
+    printf(stdout, "munmap shared failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  if(n != sizeof(buf) || buf[10] != 'Y' || buf[11] != 'Z' ||
+     buf[4096] != 'a' + 4096 % 26){
+    printf(stdout, "mmap shared write not in file\n");
+    exit();
+  }
+  p = mmap(fd, 0, 4096, PROT_READ, MAP_SHARED);
+  if(p == (char*)-1 || read(fd, p, 10) >= 0){
+    printf(stdout, "read into read-only mapping succeeded\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapfile");
+  printf(stdout, "mmap test OK\n");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -457,6 +588,71 @@ mem(void)
   }
 }
 
+void
+synctest(void)
+{
+  int fd;
+  char buf[8];
+
+  printf(1, "sync test\n");
+  fd = open("syncfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "durable", 7) != 7){
+    printf(1, "sync: write failed\n");
+    exit();
+  }
+  if(fsync(fd) < 0 || sync() < 0 || fsync(-1) >= 0){
+    printf(1, "sync: fsync failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("syncfile", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 7) != 7 || buf[0] != 'd' || buf[6] != 'e'){
+    printf(1, "sync: read back failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("syncfile");
+  printf(1, "sync ok\n");
+}
+
+void
+malloctest(void)
+{
+  char *p, *q, *top;
+  int i;
+
+  printf(1, "malloc test\n");
+  p = calloc(100, 4);
+  for(i = 0; i < 400; i++)
+    if(p[i] != 0){
+      printf(1, "calloc not zeroed\n");
+      exit();
+    }
+  for(i = 0; i < 400; i++)
+    p[i] = i;
+  p = realloc(p, 5000);
+  for(i = 0; i < 400; i++)
+    if(p[i] != (char)i){
+      printf(1, "realloc lost data\n");
+      exit();
+    }
+  free(p);
+
+  // A big block freed at the top of the heap goes back to the kernel.
+  top = sbrk(0);
+  q = malloc(256*1024);
+  if(q == 0 || sbrk(0) <= top){
+    printf(1, "malloc big failed\n");
+    exit();
+  }
+  free(q);
+  if(sbrk(0) > top){
+    printf(1, "heap not trimmed\n");
+    exit();
+  }
+  printf(1, "malloc ok\n");
+}
+
 // More file system tests
 
 // two processes write to the same file descriptor
@@ -931,6 +1127,47 @@ bigdir(void)
   printf(1, "bigdir ok\n");
 }
 
+// A directory past one block's worth of entries is hashed;
+// its entries must still be found, and it must still be
+// empty once they are all removed.
+void
+hashdir(void)
+{
+  int i, fd;
+  char name[8];
+
+  printf(1, "hashdir test\n");
+  if(mkdir("hd") != 0){
+    printf(1, "hashdir mkdir failed\n");
+    exit();
+  }
+  strcpy(name, "hd/h000");
+  for(i = 0; i < 400; i++){
+    name[4] = '0' + i/100;
+    name[5] = '0' + (i/10)%10;
+    name[6] = '0' + i%10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "hashdir create %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  for(i = 0; i < 400; i++){
+    name[4] = '0' + i/100;
+    name[5] = '0' + (i/10)%10;
+    name[6] = '0' + i%10;
+    if(unlink(name) != 0){
+      printf(1, "hashdir unlink %s failed\n", name);
+      exit();
+    }
+  }
+  if(unlink("hd") != 0){
+    printf(1, "hashdir rmdir failed\n");
+    exit();
+  }
+  printf(1, "hashdir ok\n");
+}
+
 void
 subdir(void)
 {
@@ -1347,8 +1584,10 @@ iref(void)
 
   printf(1, "empty file name\n");
 
-  // the 50 is NINODE
-  for(i = 0; i < 50 + 1; i++){
+  // Use more inodes than NINODE, the least the inode cache
+  // keeps, so that it has to grow past it or recycle entries
+  // that namei() has let go of.
+  for(i = 0; i < NINODE + 1; i++){
     if(mkdir("irefd") != 0){
       printf(1, "mkdir irefd failed\n");
       exit();
@@ -1411,6 +1650,217 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+struct memstat ms;  // too big for the stack
+
+// sbrk() only reserves address space: a region as large as
+// half of free memory should work if little of it is touched,
+// but one larger than memory plus swap should be refused.
+void
+lazytest(void)
+{
+  char *a, *p;
+  uint sz;
+
+  printf(stdout, "lazy sbrk test\n");
+  if(sbrk(1024*1024*1024) != (char*)0xffffffff){
+    printf(stdout, "lazy sbrk test 1GB sbrk succeeded\n");
+    exit();
+  }
+  if(memstat(&ms) < 0){
+    printf(stdout, "lazy sbrk test memstat failed\n");
+    exit();
+  }
+  sz = ms.free / 2 * 4096;
+  a = sbrk(sz);
+  if(a == (char*)0xffffffff){
+    printf(stdout, "lazy sbrk test sbrk failed\n");
+    exit();
+  }
+  for(p = a; p < a + sz; p += 1024*1024){
+    if(*p != 0){
+      printf(stdout, "lazy sbrk test page not zero\n");
+      exit();
+    }
+    *p = 1;
+  }
+  if(sbrk(-sz) == (char*)0xffffffff){
+    printf(stdout, "lazy sbrk test could not deallocate\n");
+    exit();
+  }
+  printf(stdout, "lazy sbrk test OK\n");
+}
+
+// A system call writing into a page sbrk() has not yet
+// faulted in must fault it in, not crash the kernel.
+void
+lazyread(void)
+{
+  char *a;
+  int fd, n;
+
+  printf(stdout, "lazy read test\n");
+  a = sbrk(2*4096);
+  if(a == (char*)0xffffffff){
+    printf(stdout, "lazy read test sbrk failed\n");
+    exit();
+  }
+  fd = open("README", O_RDONLY);
+  if(fd < 0){
+    printf(stdout, "lazy read test open README failed\n");
+    exit();
+  }
+  // Straddle the two fresh pages.
+  n = read(fd, a + 4096 - 100, 200);
+  close(fd);
+  if(n != 200){
+    printf(stdout, "lazy read test read returned %d\n", n);
+    exit();
+  }
+  sbrk(-2*4096);
+  printf(stdout, "lazy read test OK\n");
+}
+
+// Touch more memory than is free, so swapd has to page some
+// of it out, and check that every page reads back intact.
+void
+swaptest(void)
+{
+  char *a, *p;
+  int spare;
+  uint n;
+
+  printf(stdout, "swap test\n");
+  if(memstat(&ms) < 0){
+    printf(stdout, "swap test memstat failed\n");
+    exit();
+  }
+  if(ms.swaptotal == 0){
+    printf(stdout, "swap test no swap area\n");
+    exit();
+  }
+  // Past free memory, but within what sbrk() will promise:
+  // free swap less the 1/(4*SWAPLOW) of memory kept back.
+  spare = ms.swaptotal - ms.swapused - ms.total/(4*SWAPLOW);
+  n = ms.free + spare/2;
+  a = sbrk(n*4096);
+  if(a == (char*)0xffffffff){
+    printf(stdout, "swap test sbrk failed\n");
+    exit();
+  }
+  for(p = a; p < a + n*4096; p += 4096)
+    *(int*)p = (int)p;
+  if(memstat(&ms) < 0 || ms.swapused == 0){
+    printf(stdout, "swap test nothing paged out\n");
+    exit();
+  }
+  for(p = a; p < a + n*4096; p += 4096){
+    if(*(int*)p != (int)p){
+      printf(stdout, "swap test page at %x read back wrong\n", p);
+      exit();
+    }
+  }
+  sbrk(-n*4096);
+  printf(stdout, "swap test OK\n");
+}
+
+// fork shares pages copy-on-write: can a process with more
+// than half of memory in use fork, and do writes in the
+// child stay out of the parent's pages?
+void
+cowtest(void)
+{
+  char *a, *p;
+  int fds[2], pid;
+  uint sz;
+
+  printf(stdout, "cow test\n");
+  if(memstat(&ms) < 0){
+    printf(stdout, "cow test memstat failed\n");
+    exit();
+  }
+  sz = (ms.free - ms.free/4) * 4096;
+  a = sbrk(sz);
+  if(a == (char*)0xffffffff){
+    printf(stdout, "cow test sbrk failed\n");
+    exit();
+  }
+  for(p = a; p < a + sz; p += 4096)
+    *(int*)p = (int)p;
+
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "cow test fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(p = a; p < a + sz; p += 4096){
+      if(*(int*)p != (int)p){
+        printf(stdout, "cow test child read wrong value\n");
+        exit();
+      }
+    }
+    for(p = a; p < a + 64*4096; p += 4096)
+      *(int*)p = -1;
+    // A read() into a shared page has to copy it as well.
+    if(pipe(fds) != 0 || write(fds[1], "xxxx", 4) != 4 ||
+       read(fds[0], a + 64*4096, 4) != 4)
+      printf(stdout, "cow test read into shared page failed\n");
+    exit();
+  }
+  wait();
+  for(p = a; p < a + sz; p += 4096){
+    if(*(int*)p != (int)p){
+      printf(stdout, "cow test parent saw child's write\n");
+      exit();
+    }
+  }
+  sbrk(-sz);
+  printf(stdout, "cow test OK\n");
+}
+
+// memstat() should count pages a process touches as in use,
+// in the free count and in the process's resident size, and
+// as free again once sbrk() gives them back.
+void
+memstattest(void)
+{
+  char *a, *p;
+  int i, pid;
+  uint before, n;
+
+  printf(stdout, "memstat test\n");
+  n = 256;
+  pid = getpid();
+  if(memstat(&ms) < 0){
+    printf(stdout, "memstat test memstat failed\n");
+    exit();
+  }
+  before = ms.free;
+  a = sbrk(n*4096);
+  if(a == (char*)0xffffffff){
+    printf(stdout, "memstat test sbrk failed\n");
+    exit();
+  }
+  for(p = a; p < a + n*4096; p += 4096)
+    *p = 1;
+  if(memstat(&ms) < 0 || ms.free + n/2 > before){
+    printf(stdout, "memstat test free pages did not drop\n");
+    exit();
+  }
+  for(i = 0; i < ms.nproc && ms.proc[i].pid != pid; i++)
+    ;
+  if(i == ms.nproc || ms.proc[i].rss < n){
+    printf(stdout, "memstat test resident size too small\n");
+    exit();
+  }
+  sbrk(-n*4096);
+  if(memstat(&ms) < 0 || ms.free + n/2 < before){
+    printf(stdout, "memstat test free pages did not come back\n");
+    exit();
+  }
+  printf(stdout, "memstat test OK\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1768,6 +2218,11 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  lazytest();
+  lazyread();
+  swaptest();
+  cowtest();
+  memstattest();
   validatetest();
 
   opentest();
@@ -1780,6 +2235,10 @@ main(int argc, char *argv[])
   iputtest();
 
   mem();
+  spawntest();
+  mmaptest();
+  malloctest();
+  synctest();
   pipe1();
   preempt();
   exitwait();
@@ -1794,6 +2253,7 @@ main(int argc, char *argv[])
   iref();
   forktest();
   bigdir(); // slow
+  hashdir();
 
   uio();
 
@@ -5,11 +5,20 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
 #include "elf.h"
+#include "stat.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// Protects cpu->curpgdir and cpu->deadpgdir on every CPU.
+static struct spinlock pgdirlock;
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -38,13 +47,14 @@ pte_t * walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return 0;  // 4MB kernel mapping, no page table
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
+    // kzalloc makes sure all those PTE_P bits are zero.
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
       return 0;
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -90,13 +100,29 @@ int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, found
+// at boot and at most PHYSLIMIT) (directly addressable from
+// end..P2V(phystop)).
+//
+// The kernel half is built once, in kpgdir, and is the same in
+// every address space. It uses 4MB superpages (PTE_PS) wherever
+// a mapping is 4MB aligned, so only the first 4MB, which holds
+// the read-only kernel text, needs a page table. setupkvm() just
+// copies the kernel PDEs, so every page directory shares those
+// page tables; freevm() frees only the user half.
+//
+// Kernel mappings are marked PTE_G, so their TLB entries survive
+// cr3 loads. The scheduler also leaves the last process's page
+// directory loaded instead of switching to kpgdir, and skips the
+// cr3 load altogether when the same process runs on the same CPU
+// again. Because a CPU may hold a page directory after its process
+// has exited, freevm() leaves the page directory page to be freed
+// by that CPU at its next switch.
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -108,51 +134,105 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
+ { (void*)data,     V2P(data),     0,         PTE_W}, // kern data+memory
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+#define SUPERPGSIZE (NPTENTRIES*PGSIZE)  // bytes mapped by a PTE_PS PDE
+
+// Like mappages, but use a superpage for each 4MB-aligned
+// stretch of the range. size may wrap to the top of memory.
+static int
+kmappages(pde_t *pgdir, uint va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  while(size > 0){
+    if(va % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       size >= SUPERPGSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("kmappages: remap");
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS | PTE_G;
+      n = SUPERPGSIZE;
+    } else {
+      n = PGSIZE;
+      if(mappages(pgdir, (void*)va, n, pa, perm | PTE_G) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// Set up kernel part of a page table by sharing kpgdir's.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
-// Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// Build the kernel's page table, used by the scheduler and
+// shared by every process, and switch to it.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  kmap[2].phys_end = phystop;  // known only at boot
+  initlock(&pgdirlock, "pgdir");
+  if((kpgdir = (pde_t*)kzalloc()) == 0)
+    panic("kvmalloc");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(kmappages(kpgdir, (uint)k->virt, k->phys_end - k->phys_start,
+                 k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
+// Load pgdir into this CPU's cr3, and free a page directory
+// that was released while this CPU still had it loaded.
+static void
+loadpgdir(pde_t *pgdir)
+{
+  struct cpu *c, *o;
+  pde_t *dead;
+
+  pushcli();
+  c = mycpu();
+  acquire(&pgdirlock);
+  lcr3(V2P(pgdir));
+  c->curpgdir = pgdir;
+  dead = c->deadpgdir;
+  c->deadpgdir = 0;
+  c->cr3loads++;
+  for(o = cpus; dead && o < cpus+ncpu; o++)
+    if(o->deadpgdir == dead)
+      dead = 0;  // the last CPU to let go frees it
+  release(&pgdirlock);
+  popcli();
+  if(dead)
+    kfree((char*)dead);
+}
+
 // Switch h/w page table register to the kernel-only page table,
 // for when no process is running.
 void
 switchkvm(void)
 {
-  lcr3(V2P(kpgdir));   // switch to the kernel page table
+  loadpgdir(kpgdir);   // switch to the kernel page table
 }
 
-// Switch TSS and h/w page table to correspond to process p.
-void
-switchuvm(struct proc *p)
+// Load the TSS for process p's kernel stack.
+static void
+switchtss(struct proc *p)
 {
   if(p == 0)
     panic("switchuvm: no process");
@@ -171,10 +251,43 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
   popcli();
 }
 
+// Switch TSS and h/w page table to correspond to process p.
+// Always reloads cr3, which also flushes p's stale TLB entries
+// after its mappings have been removed or changed.
+void
+switchuvm(struct proc *p)
+{
+  switchtss(p);
+  loadpgdir(p->pgdir);  // switch to process's address space
+  pushcli();
+  p->lastcpu = mycpu();
+  popcli();
+}
+
+// Like switchuvm, for the scheduler. If this CPU still has p's
+// page directory loaded and p has not run anywhere else since,
+// p's TLB entries here are current and cr3 is left alone.
+// Caller holds ptable.lock.
+void
+resumeuvm(struct proc *p)
+{
+  struct cpu *c;
+
+  switchtss(p);
+  pushcli();
+  c = mycpu();
+  if(c->curpgdir == p->pgdir && p->lastcpu == c){
+    c->cr3skips++;
+    popcli();
+    return;
+  }
+  popcli();
+  switchuvm(p);
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -184,8 +297,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -229,13 +341,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -271,6 +382,9 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+    } else if(*pte & PTE_SWAP){
+      swapfree(PTE_SLOT(*pte));
+      *pte = 0;
     }
   }
   return newsz;
@@ -281,18 +395,61 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 void
 freevm(pde_t *pgdir)
 {
+  struct cpu *c;
+  int held;
   uint i;
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
+  held = 0;
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){  // kernel page tables are shared
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
+      pgdir[i] = 0;
     }
   }
-  kfree((char*)pgdir);
+
+  // CPUs that last ran this address space may still have it in
+  // cr3; the last of them frees the page at its next switch.
+  pushcli();
+  acquire(&pgdirlock);
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c->curpgdir != pgdir)
+      continue;
+    if(c == mycpu())
+      panic("freevm: in use");
+    c->deadpgdir = pgdir;
+    held = 1;
+  }
+  release(&pgdirlock);
+  popcli();
+  if(!held)
+    kfree((char*)pgdir);
+}
+
+// Count the resident pages in the user part of pgdir.
+// *ptpages is set to the number of page table pages,
+// including the directory.
+uint
+uvmrss(pde_t *pgdir, uint *ptpages)
+{
+  pte_t *pgtab;
+  uint i, j, n;
+
+  n = 0;
+  *ptpages = 1;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!(pgdir[i] & PTE_P) || PTE_ADDR(pgdir[i]) >= phystop)
+      continue;
+    (*ptpages)++;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++)
+      if(pgtab[j] & PTE_P)
+        n++;
+  }
+  return n;
 }
 
 // Clear PTE_U on a page. Used to create an inaccessible
@@ -308,37 +465,537 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Map the pages of pgdir in [start, end) into d as well.
+// Writable pages are not copied: both page tables map them
+// read-only with PTE_COW, and the first write to either copy
+// faults into cowfault(). Pages marked PTE_SHARED stay
+// writable in both. The caller must flush pgdir's TLB.
+static int
+copyrange(pde_t *d, pde_t *pgdir, uint start, uint end)
+{
+  pte_t *pte, *npte;
+  uint pa, i, flags;
+
+  for(i = start; i < end; i += PGSIZE){
+    // Pages never touched are not mapped; the child
+    // faults in its own copy too.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
+      continue;
+    // A paged-out page is shared through its swap slot.
+    if(*pte & PTE_SWAP){
+      if((npte = walkpgdir(d, (void *) i, 1)) == 0)
+        return -1;
+      *npte = *pte;
+      swapdup(PTE_SLOT(*pte));
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    if((*pte & (PTE_W|PTE_SHARED)) == PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE_ADDR(*pte);
+    flags = PTE_FLAGS(*pte);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+      return -1;
+    kdup(P2V(pa));
+  }
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child, sharing the pages (see copyrange).
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
+  int r;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
+  r = copyrange(d, pgdir, 0, sz);
+  // The parent's writable PTEs just became read-only.
+  lcr3(V2P(pgdir));
+  if(r < 0){
+    freevm(d);
+    return 0;
+  }
+  return d;
+}
+
+// Resolve a write fault on a copy-on-write page at user
+// address va. The last reference to a page just regains
+// PTE_W; otherwise the page is copied. Returns 0 on success,
+// -1 if va is not a copy-on-write page or memory ran out.
+static int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem, *old;
+
+  if(va >= KERNBASE)
+    return -1;
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  old = P2V(PTE_ADDR(*pte));
+  if(krefcnt(old) == 1){
+    *pte = (*pte | PTE_W) & ~PTE_COW;
+  } else {
     if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
+      return -1;
+    memmove(mem, old, PGSIZE);
+    *pte = V2P(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+    kfree(old);
+  }
+  invlpg((void*)PGROUNDDOWN(va));
+  return 0;
+}
+
+// Map a zeroed page at va, which lies inside the process
+// image but has not been touched since sbrk() reserved it.
+static int
+zerofault(pde_t *pgdir, uint va)
+{
+  char *mem;
+
+  if((mem = kzalloc()) == 0){
+    cprintf("zerofault: out of memory\n");
+    return -1;
+  }
+  if(mappages(pgdir, (char*)PGROUNDDOWN(va), PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Read back a page that swapd paged out.
+static int
+swapfault(pte_t *pte)
+{
+  char *mem;
+  uint slot;
+
+  if((mem = kalloc()) == 0){
+    cprintf("swapfault: out of memory\n");
+    return -1;
+  }
+  slot = PTE_SLOT(*pte);
+  swapread(slot, mem);
+  *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~(PTE_SWAP|PTE_A|PTE_D)) | PTE_P;
+  swapfree(slot);
+  return 0;
+}
+
+// Map the page at va of file-backed region v. A shared
+// region maps the page cache's own page; a private one gets
+// a freshly zeroed page with the file's bytes read into it.
+static int
+filefault(pde_t *pgdir, struct vma *v, uint va)
+{
+  char *mem;
+  uint i, n;
+  int perm;
+
+  va = PGROUNDDOWN(va);
+  i = va - v->start;
+  if(v->flags & MAP_SHARED){
+    ilock(v->ip);
+    mem = pcachemap(v->ip, (v->off + i) / PGSIZE);
+    iunlock(v->ip);
+    if(mem == 0){
+      cprintf("filefault: out of memory\n");
+      return -1;
+    }
+  } else {
+    if((mem = kzalloc()) == 0){
+      cprintf("filefault: out of memory\n");
+      return -1;
+    }
+    if(i < v->filesz){
+      n = v->filesz - i;
+      if(n > PGSIZE)
+        n = PGSIZE;
+      ilock(v->ip);
+      if(readi(v->ip, mem, v->off + i, n) != n){
+        iunlock(v->ip);
+        kfree(mem);
+        return -1;
+      }
+      iunlock(v->ip);
     }
   }
-  return d;
+  // Another fault may have mapped the page while we slept.
+  if(uva2ka(pgdir, (char*)va) != 0){
+    kfree(mem);
+    return 0;
+  }
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->flags & MAP_SHARED)
+    perm |= PTE_SHARED;
+  if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Return the file-backed region of p containing va, or 0.
+static struct vma*
+vmalookup(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->ip && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Give np its own references to p's file-backed regions,
+// and map p's mmap() pages into np->pgdir the way copyuvm()
+// maps the image. Returns -1 if out of memory.
+int
+vmadup(struct proc *np, struct proc *p)
+{
+  int i, r;
+
+  r = 0;
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    if(np->vma[i].ip == 0)
+      continue;
+    idup(np->vma[i].ip);
+    if(r == 0 && p->vma[i].start >= MMAPBASE)
+      r = copyrange(np->pgdir, p->pgdir, p->vma[i].start, p->vma[i].end);
+  }
+  lcr3(V2P(p->pgdir));
+  return r;
+}
+
+// Drop the file references of the regions in vma[].
+// Must be called inside a transaction since it calls iput().
+void
+vmafree(struct vma *vma)
+{
+  struct vma *v;
+
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(v->ip)
+      iput(v->ip);
+    memset(v, 0, sizeof(*v));
+  }
+}
+
+// Handle a page fault at user address va in process p,
+// with x86 error code err. Returns 0 if the fault was
+// resolved and the instruction can be restarted, or -1
+// if it is a genuine access violation.
+int
+pagefault(struct proc *p, uint va, uint err)
+{
+  pte_t *pte;
+  struct vma *v;
+  int r;
+
+  if(va >= KERNBASE)
+    return -1;
+  v = vmalookup(p, va);
+  if(v == 0 && va >= p->sz)
+    return -1;
+  if(v && (err & FEC_WR) && !(v->prot & PROT_WRITE))
+    return -1;
+  swapwait();
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_SWAP))
+    r = swapfault(pte);
+  else if(pte && (*pte & PTE_P)){
+    if(!(err & FEC_WR))
+      return -1;
+    r = cowfault(p->pgdir, va);
+  } else if(v)
+    r = filefault(p->pgdir, v, va);
+  else if((r = zerofault(p->pgdir, va)) == 0 && p->ncommit > 0){
+    // The page sbrk() promised is real now.
+    p->ncommit--;
+    kcommit(-1);
+  }
+  if(r == 0)
+    p->pgfaults++;
+  return r;
+}
+
+// One step of swapd's clock scan over p: look for a page to
+// page out to swap slot, from *va up. A page accessed since
+// the last pass only has its PTE_A cleared. Only private
+// anonymous pages are taken, not file-backed or shared ones.
+// The page's PTE becomes a PTE_SWAP entry for slot. Returns
+// the page with *va just past it, or 0 at the end of p.
+// Caller holds ptable.lock and p is not running.
+char*
+uvmevict(struct proc *p, uint *va, uint slot)
+{
+  pte_t *pte;
+  char *mem;
+  uint a;
+
+  for(a = PGROUNDDOWN(*va); a < p->sz; a += PGSIZE){
+    if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U|PTE_SHARED)) != (PTE_P|PTE_U) || vmalookup(p, a))
+      continue;
+    // Clearing PTE_A or the PTE leaves a stale TLB entry on a
+    // CPU that last ran p; resumeuvm() reloads cr3 when lastcpu
+    // does not match.
+    p->lastcpu = 0;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    mem = P2V(PTE_ADDR(*pte));
+    if(krefcnt(mem) != 1)
+      continue;
+    *pte = (slot << PTXSHIFT) | (PTE_FLAGS(*pte) & ~PTE_P) | PTE_SWAP;
+    *va = a + PGSIZE;
+    return mem;
+  }
+  *va = a;
+  return 0;
+}
+
+// Return the end of the region of p's address space that
+// contains va: the image below sz, or an mmap() region.
+// Returns 0 if va is not mapped.
+uint
+uvmlimit(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  if(va < p->sz)
+    return p->sz;
+  if((v = vmalookup(p, va)) != 0)
+    return v->end;
+  return 0;
+}
+
+// Count the pages of [start, end) in pgdir that were never
+// faulted in: neither mapped nor paged out to swap.
+uint
+uvmuntouched(pde_t *pgdir, uint start, uint end)
+{
+  pte_t *pte;
+  uint a, next, n;
+
+  n = 0;
+  end = PGROUNDUP(end);
+  for(a = PGROUNDUP(start); a < end; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      // No page table: the rest of this 4MB is untouched.
+      next = PGADDR(PDX(a) + 1, 0, 0);
+      if(next > end || next == 0)
+        next = end;
+      n += (next - a) / PGSIZE;
+      a = next - PGSIZE;
+      continue;
+    }
+    if(!(*pte & (PTE_P|PTE_SWAP)))
+      n++;
+  }
+  return n;
+}
 
-bad:
-  freevm(d);
+// Make sure the user pages in [va, va+len) of process p are
+// mapped, faulting them in if needed, so the kernel can access
+// them while holding a spin-lock. If write is set the kernel
+// is about to store into them: copy-on-write pages are copied
+// now, and read-only mappings are refused. Returns -1 on a bad
+// address.
+int
+uvmtouch(struct proc *p, uint va, uint len, int write)
+{
+  uint a, last;
+  pte_t *pte;
+
+  if(len == 0)
+    return 0;
+  if(va + len < va || va + len > uvmlimit(p, va))
+    return -1;
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + len - 1);
+  for(; a <= last; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_P) && (!write || (*pte & PTE_W)))
+      continue;
+    if(pagefault(p, a, write ? FEC_WR : 0) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Map len bytes of ip, from file offset off, into p at the
+// lowest free address above MMAPBASE. Pages are brought in
+// by filefault() when first touched. A MAP_PRIVATE page is a
+// copy of the file as it was then, zero past the size the
+// file had at mmap() time, and stores to it stay in p. A
+// MAP_SHARED page is the file's page in the page cache, so
+// read(), write() and other shared mappings of the file see
+// the same bytes at once; dirty pages are written to disk by
+// munmap(), exec() and exit(), up to the file's current size.
+// Stores past the end of the file are not written back, and
+// mmap() never grows a file. Returns the address, or -1.
+uint
+mmap(struct proc *p, struct inode *ip, uint off, uint len, int prot, int flags)
+{
+  struct vma *v, *nv;
+  uint a, size;
+
+  if(len == 0 || len > KERNBASE - MMAPBASE || off % PGSIZE != 0)
+    return -1;
+  len = PGROUNDUP(len);
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->ip == 0 && nv == 0)
+      nv = v;
+  if(nv == 0)
+    return -1;
+
+  a = MMAPBASE;
+again:
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip && v->start < a + len && a < v->end){
+      a = v->end;
+      goto again;
+    }
+  }
+  if(a + len > KERNBASE || a + len < a)
+    return -1;
+
+  ilock(ip);
+  if(ip->type != T_FILE){
+    iunlock(ip);
+    return -1;
+  }
+  size = ip->size;
+  iunlock(ip);
+  nv->start = a;
+  nv->end = a + len;
+  nv->ip = idup(ip);
+  nv->off = off;
+  nv->filesz = 0;
+  if(size > off)
+    nv->filesz = size - off < len ? size - off : len;
+  nv->prot = prot;
+  nv->flags = flags;
+  return a;
+}
+
+// Write the dirty pages of shared mapping v in [start, end)
+// back to its file, through the log, as far as the file's
+// current end.
+static void
+vmawriteback(pde_t *pgdir, struct vma *v, uint start, uint end)
+{
+  // As in filewrite: a transaction has room for i-node,
+  // indirect block, allocation blocks, and 2 blocks of slop.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint a, off, done, m;
+  pte_t *pte;
+  char *mem;
+
+  if(!(v->flags & MAP_SHARED) || !(v->prot & PROT_WRITE))
+    return;
+  for(a = start; a < end; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    mem = P2V(PTE_ADDR(*pte));
+    for(done = 0; done < PGSIZE; done += m){
+      begin_op();
+      ilock(v->ip);
+      off = v->off + (a - v->start) + done;
+      m = 0;
+      if(off < v->ip->size){
+        m = PGSIZE - done;
+        if(m > max)
+          m = max;
+        if(m > v->ip->size - off)
+          m = v->ip->size - off;
+        writei(v->ip, mem + done, off, m);
+      }
+      iunlock(v->ip);
+      end_op();
+      if(m == 0)
+        break;
+    }
+  }
+}
+
+// Write back every shared mapping of p. Called before p's
+// address space is thrown away by exec() or exit().
+void
+vmasync(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->ip && v->start >= MMAPBASE)
+      vmawriteback(p->pgdir, v, v->start, v->end);
+}
+
+// Remove the mapping of [addr, addr+len) from p, which must
+// lie within one region made by mmap(). Returns 0 or -1.
+int
+munmap(struct proc *p, uint addr, uint len)
+{
+  struct vma *v, *nv;
+  uint end, cut;
+
+  if((v = vmalookup(p, addr)) == 0 || v->start < MMAPBASE)
+    return -1;
+  end = addr + PGROUNDUP(len);
+  if(addr % PGSIZE != 0 || len == 0 || end < addr || end > v->end)
+    return -1;
+  nv = 0;
+  if(addr > v->start && end < v->end){
+    // Punching a hole needs a second region.
+    for(nv = p->vma; nv < &p->vma[NVMA] && nv->ip; nv++)
+      ;
+    if(nv == &p->vma[NVMA])
+      return -1;
+  }
+
+  vmawriteback(p->pgdir, v, addr, end);
+  deallocuvm(p->pgdir, end, addr);
+
+  if(addr == v->start && end == v->end){
+    begin_op();
+    iput(v->ip);
+    end_op();
+    memset(v, 0, sizeof(*v));
+  } else if(addr == v->start){
+    cut = end - v->start;
+    v->start = end;
+    v->off += cut;
+    v->filesz = v->filesz > cut ? v->filesz - cut : 0;
+  } else {
+    if(nv){
+      cut = end - v->start;
+      *nv = *v;
+      idup(nv->ip);
+      nv->start = end;
+      nv->off += cut;
+      nv->filesz = v->filesz > cut ? v->filesz - cut : 0;
+    }
+    v->end = addr;
+    if(v->filesz > addr - v->start)
+      v->filesz = addr - v->start;
+  }
+  switchuvm(p);  // flush the TLB
   return 0;
 }
 
@@ -350,7 +1007,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -365,10 +1022,16 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_SWAP) && swapfault(pte) < 0)
+      return -1;
+    if(pte && (*pte & PTE_COW) && cowfault(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;